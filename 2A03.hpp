@@ -1,5 +1,6 @@
 #pragma once
 #include <cassert>
+#include <algorithm>
 #include <array>
 #include <vector>
 #include <functional>
@@ -7,7 +8,10 @@
 #include "debug.hpp"
 #include "byte.hpp"
 #include "counter.hpp"
+#include "state-fields.hpp"
 #include "memory.hpp"
+#include "blip-buffer.hpp"
+#include "apu-mixer.hpp"
 
 class Cpu {
     private:
@@ -1146,12 +1150,51 @@ class Cpu {
 
 
     public:
-        //Tick counter:
+        //Tick counter (including cycles halted for DMA):
         u32_fast cycle {0};
 
         //Memory:
         MappedMemory<> memory{0};
 
+        //DMA:
+        //A DMA unit takes the bus by pushing the CPU's next cycle back on 
+        //the system clock, so nothing is checked per cycle while none is 
+        //running.
+        //Cycle at which the last OAM DMA ends:
+        u32_fast oamDmaEnd {0};
+
+        void halt(const u16_fast cycles) {
+            timer.counter += cycles * (timer.reload + 1);
+            cycle += cycles;
+        }
+        bool isHalted() const {
+            return timer.counter > timer.reload;
+        }
+
+        //Halts for an OAM DMA started by the current (write) cycle and 
+        //returns its length in cycles:
+        u16_fast haltForOamDma() {
+            //1 halt cycle, 1 alignment cycle when starting on a put (odd)
+            //cycle, then 256 get/put pairs:
+            const u16_fast cycles = 513 + (cycle & 1);
+            halt(cycles);
+            //(the write cycle itself is counted once it returns)
+            oamDmaEnd = cycle + 1;
+            return cycles;
+        }
+        //Halts for a DMC sample fetch:
+        void haltForDmcDma() {
+            //A fetch takes 4 cycles (halt, dummy, alignment, get) but only
+            //2 when it steals an OAM DMA's bus slots:
+            if (isHalted() && cycle == oamDmaEnd) {
+                halt(2);
+                oamDmaEnd = cycle;
+            }
+            else {
+                halt(4);
+            }
+        }
+
         void reset() {
             doNotInterrupt = false;
             nmiPending = false;
@@ -1207,122 +1250,74 @@ class Cpu {
             timer.tick(ticks);
         }
 
-        template <typename StateType>
-        void dumpState(StateType& state) {
-            auto dump {[&] (const u8 data) {
-                //                  size in bytes
-                state.write(&data,              1);
-            }};
-
-            dump(a);
-            dump(x);
-            dump(y);
-            dump(pc & 0x00FF);
-            dump(pc >> 8);
-            dump(sp);
-            dump(p);
-            
+        //Savestate layout (see state-fields.hpp):
+        template <typename Fields>
+        void stateFields(Fields& fields) {
+            fields.section("registers");
+            fields.value("a", a, 1);
+            fields.value("x", x, 1);
+            fields.value("y", y, 1);
+            fields.value("pc", pc, 2);
+            fields.value("sp", sp, 1);
+            fields.value("p", p, 1);
+
+            fields.section("instruction");
             {
-                u8 originalOpcode =
-                        (instrCycle == instrCycles[27].begin() + 2
-                     || instrCycle == instrCycles[27].begin() + 3) 
-                      ? 27
-                      : opcode;
-                dump(originalOpcode);
-                dump(opcode);
-                dump(value);
-                dump(pointerAddress);
-                dump(pointerAddressHigh);
-                dump(address & 0x00FF);
-                dump(address >> 8);
-                dump(offset);
-                dump(
-                        instrCycle 
-                      - instrCycles[instrTimings[originalOpcode]].begin());
-                dump(instrCycleStep);
+                //The timing being run isn't always the opcode's (branches
+                //fetch the next opcode before their last cycles), so it
+                //is looked up:
+                u8_fast timing = instrTimings[opcode];
+                if (
+                        instrCycle < instrCycles[timing].begin()
+                     || instrCycle >= instrCycles[timing].end()) {
+                    for (timing = 0; timing < instrCycles.size(); ++timing) {
+                        if (
+                                instrCycle >= instrCycles[timing].begin()
+                             && instrCycle < instrCycles[timing].end()) {
+                            break;
+                        }
+                    }
+                }
+                u8_fast position = instrCycle - instrCycles[timing].begin();
+                fields.value("timing", timing, 1);
+                fields.value("opcode", opcode, 1);
+                fields.value("value", value, 1);
+                fields.value("pointerAddress", pointerAddress, 1);
+                fields.value("pointerAddressHigh", pointerAddressHigh, 1);
+                fields.value("address", address, 2);
+                fields.value("offset", offset, 1);
+                fields.value("instrCycle", position, 1);
+                fields.value("instrCycleStep", instrCycleStep, 1);
+                if (fields.isLoading()) {
+                    instrCycle = instrCycles[timing].begin() + position;
+                }
             }
 
-            dump(irqLevel & 0x000000FF);
-            dump(irqLevel >> 8 & 0x0000FF);
-            dump(irqLevel >> 16 & 0x00FF);
-            dump(irqLevel >> 24);
-            dump(irqDevices);
-            dump(nmiLevel);
-            dump(irqPending);
-            dump(nmiPending);
-            dump(doNotInterrupt);
-
-            dump(cycle & 0x000000FF);
-            dump(cycle >> 8 & 0x0000FF);
-            dump(cycle >> 16 & 0x00FF);
-            dump(cycle >> 24);
-            dump(timer.reload & 0x00FF);
-            dump(timer.reload >> 8);
-            dump(timer.counter & 0x00FF);
-            dump(timer.counter >> 8);
-
-            state.write(reinterpret_cast<const char*>(
-                    memory.memory.data()),
-                    0x0800);
+            fields.section("interrupts");
+            fields.value("irqLevel", irqLevel, 4);
+            fields.value("irqDevices", irqDevices, 1);
+            fields.value("nmiLevel", nmiLevel, 1);
+            fields.value("irqPending", irqPending, 1);
+            fields.value("nmiPending", nmiPending, 1);
+            fields.value("doNotInterrupt", doNotInterrupt, 1);
+
+            fields.section("timing");
+            fields.value("cycle", cycle, 4);
+            fields.value("oamDmaEnd", oamDmaEnd, 4);
+            fields.counter("timer", timer, 2);
+
+            fields.section("memory");
+            fields.block("ram", memory.memory.data(), 0x0800);
+        }
+        template <typename StateType>
+        void dumpState(StateType& state) {
+            savestate::FieldWriter<StateType> fields {state};
+            stateFields(fields);
         }
         template <typename StateType>
         void loadState(StateType& state) {
-            auto load {[&] () {
-                u8 result;
-                //                   size in bytes
-                state.read(&result,              1);
-                return result;
-            }};
-            
-            a = load();
-            x = load();
-            y = load();
-            pc = load();
-            pc |= load() << 8;
-            sp = load();
-            p = load();
-
-            {
-                u8 originalOpcode = load();
-                opcode = load();
-                value = load();
-                pointerAddress = load();
-                pointerAddressHigh = load();
-                address = load();
-                address |= load() << 8;
-                offset = toSigned(load());
-                instrCycle = 
-                        instrCycles[instrTimings[originalOpcode]].begin() 
-                      + load();
-                instrCycleStep = load();
-            }
-
-            irqLevel = load();
-            irqLevel |= load() << 8;
-            irqLevel |= load() << 16;
-            irqLevel |= load() << 24;
-            irqDevices = load();
-            nmiLevel = load();
-            irqPending = load();
-            nmiPending = load();
-            doNotInterrupt = load();
-
-            cycle = load();
-            cycle |= load() << 8;
-            cycle |= load() << 16;
-            cycle |= load() << 24;
-
-            u16 tmp = load();
-            tmp |= load() << 8;
-            timer.reload = toSigned(tmp); 
-
-            tmp = load();
-            tmp |= load() << 8;
-            timer.counter = toSigned(tmp); 
-
-            state.read(reinterpret_cast<char*>(
-                    memory.memory.data()), 
-                    0x0800);
+            savestate::FieldReader<StateType> fields {state};
+            stateFields(fields);
         }
 
         u8_fast connectIrq() {
@@ -1361,6 +1356,17 @@ class Cpu {
 };
 
 class Apu {
+    public:
+        //Channels, and the mix of them all (for capture only):
+        enum Channel : u8_fast {
+            PULSE1,
+            PULSE2,
+            TRIANGLE,
+            NOISE,
+            DMC,
+            MIXED,
+        };
+
     private:
         //Sound units belonging to individual channels:
         struct LengthCounter {
@@ -1500,8 +1506,8 @@ class Apu {
                 timer.counter = sweep.period * 2 + 1;
             }};
 
-            void tick() {
-                timer.tick();
+            void tick(const s16_fast ticks = 1) {
+                timer.tick(ticks);
             }
 
             u8_fast output() const {
@@ -1549,8 +1555,8 @@ class Apu {
                 }
             }};
 
-            void tick() {
-                timer.tick();
+            void tick(const s16_fast ticks = 1) {
+                timer.tick(ticks);
             }
 
             u8_fast output() const {
@@ -1571,8 +1577,8 @@ class Apu {
                 setBit(lfsr, 14, feedback);
             }};
 
-            void tick() {
-                timer.tick();
+            void tick(const s16_fast ticks = 1) {
+                timer.tick(ticks);
             }
 
             u8_fast output() const {
@@ -1609,8 +1615,7 @@ class Apu {
 
             void fillSampleBuffer() {
                 if (sampleBuffer == -1 && !finished) {
-                    //TODO: proper cpu stall 
-                    apu.cpu.timer.counter += 4 * (apu.cpu.timer.reload + 1); 
+                    apu.cpu.haltForDmcDma();
                     sampleBuffer = apu.cpu.memory[address++];
                     address |= 0x8000;
                     bytesRemaining.tick();
@@ -1642,11 +1647,17 @@ class Apu {
             }};
             Counter<s16_fast> timer{427, [&] () {
                 if (!silence) {
+                    //(the other channels are run up to the change first, so
+                    //their pending output is mixed with the old level)
                     if (shiftRegister & 0x01 && volume <= 125) {
+                        apu.runChannels();
                         volume += 2;
+                        apu.updateOutput();
                     }
                     else if (!(shiftRegister & 0x01) && volume >= 2) {
+                        apu.runChannels();
                         volume -= 2;
+                        apu.updateOutput();
                     }
                 }
                 shiftRegister >>= 1;
@@ -1658,6 +1669,21 @@ class Apu {
                 timer.tick();
             }
 
+            //Ticks until the next sample fetch (-1 if none is coming):
+            u32_fast cyclesUntilFetch() const {
+                if (finished) {
+                    return -1;
+                }
+                else if (sampleBuffer == -1) {
+                    return 1;
+                }
+                //(the buffer empties when the bits remaining run out)
+                return 
+                        timer.counter + 1 
+                      + bitsRemaining.counter * (timer.reload + 1)
+                      + 1;
+            }
+
             void toggle(const bool enable) {
                 enabled = enable;
                 if (enabled && finished) {
@@ -1679,7 +1705,9 @@ class Apu {
         struct FrameCounter {
             Apu& apu;
 
-            u32_fast cycle = -3;
+            //(starts negative, a few cycles before a $4017 write takes
+            //effect)
+            s32_fast cycle {-3};
             bool fourStep {true}; 
             bool interruptInhibit {false}; 
             u8_fast irqId;
@@ -1691,21 +1719,20 @@ class Apu {
 
             void tick() {
                 ++cycle;
-                if (
-                        cycle == 7457 
-                     || cycle == 14913
-                     || cycle == 22371
+                const bool halfFrame {
+                        cycle == 14913
                      || (fourStep && cycle == 29829)
-                     || (!fourStep && cycle == 37281)) {
+                     || (!fourStep && cycle == 37281)};
+                const bool quarterFrame {
+                        halfFrame || cycle == 7457 || cycle == 22371};
+                if (quarterFrame) {
+                    apu.runChannels();
                     apu.pulse1.envelope.tick();
                     apu.pulse2.envelope.tick();
                     apu.triangle.linearCounter.tick();
                     apu.noise.envelope.tick();
                 }
-                if (
-                        cycle == 14913
-                     || (fourStep && cycle == 29829)
-                     || (!fourStep && cycle == 37281)) {
+                if (halfFrame) {
                     apu.pulse1.sweep.tick();
                     apu.pulse2.sweep.tick();
 
@@ -1714,6 +1741,9 @@ class Apu {
                     apu.triangle.lengthCounter.tick();
                     apu.noise.lengthCounter.tick();
                 }
+                if (quarterFrame) {
+                    apu.updateOutput();
+                }
                 if (fourStep && cycle >= 29828 && cycle <= 29830) {
                     apu.cpu.pullIrq(irqId);
                 }
@@ -1729,6 +1759,29 @@ class Apu {
                 }
 
             } 
+
+            //Ticks until tick next does anything, or only until it next
+            //pulls or releases the IRQ line:
+            u32_fast cyclesUntilEvent(const bool irqOnly) {
+                if (interruptInhibit && apu.cpu.isPullingIrq(irqId)) {
+                    return 1;
+                }
+                u32_fast cycles = -1;
+                for (const u32_fast event : {
+                        7457, 14913, 22371, 29828, 29829, 29830, 37281, 37282}) {
+                    const bool irq {event >= 29828 && event <= 29830};
+                    if (
+                            (fourStep ? event > 29830 : irq)
+                         || (irqOnly && !(irq && !interruptInhibit))) {
+                        continue;
+                    }
+                    const u32_fast distance {event - cycle};
+                    if (distance != 0 && distance < cycles) {
+                        cycles = distance;
+                    }
+                }
+                return cycles;
+            }
         };
 
         Cpu& cpu;
@@ -1736,6 +1789,42 @@ class Apu {
         //Tick counter:
         u32_fast cycle {0};
 
+        //Band-limited output, ended and read out every audioFrameLength
+        //ticks:
+        static constexpr u16_fast audioFrameLength {4096};
+        BlipBuffer blip {1789772.727, sampleRate, 1024};
+        //Ticks into the current audio frame:
+        u32_fast time {0};
+        //Ticks into the current audio frame the pulse, triangle and noise
+        //channels have been run to (they only run when their output is
+        //needed):
+        u32_fast channelTime {0};
+        //Mixer output as of channelTime:
+        s32_fast amplitude {0};
+
+        //Capture of each channel's output on its own, when enabled:
+        std::function<void(
+                Channel channel,
+                const s16* samples,
+                u32_fast count)> captureFunction;
+        std::vector<BlipBuffer> channelBlips;
+        std::array<s32_fast, MIXED> channelAmplitudes {};
+        std::vector<s16> captureBuffer;
+
+        //Lazy evaluation:
+        //Master ticks elapsed since the APU last ran:
+        u32_fast lag {0};
+        //Master ticks until the APU next affects anything outside itself
+        //(IRQs, DMC fetches, the end of an audio frame):
+        u32_fast deadline {0};
+
+        //Samples read from blip, waiting to be output:
+        static constexpr u16_fast ringSize {4096};
+        std::array<s16, ringSize> ring;
+        //Positions in ring (taken modulo ringSize):
+        u32_fast ringRead {0};
+        u32_fast ringWrite {0};
+
         FrameCounter frameCounter{*this};
 
         //Channels:
@@ -1745,91 +1834,13 @@ class Apu {
         Noise noise;
         Dmc dmc{*this};
 
-        //DAC output approximation tables:
-        const std::array<double, 31> pulseOutput {
-            0,
-            0.01160913952357, 0.02293948126801, 0.03400094921689, 
-            0.04480300187617, 0.05535465924895, 0.06566452795600, 
-            0.07574082464884, 0.08559139784946, 0.09522374833850, 
-            0.10464504820333, 0.11386215864759, 0.12288164665523, 
-            0.13170980059398, 0.14035264483627, 0.14881595346905, 
-            0.15710526315789, 0.16522588522589, 0.17318291700242,
-            0.18098125249302, 0.18862559241706, 0.19612045365663, 
-            0.20347017815647, 0.21067894131185, 0.21775075987842, 
-            0.22468949943545, 0.23149888143177, 0.23818248984115, 
-            0.24474377745242, 0.25118607181719, 0.25751258087707, 
-        };
-        const std::array<double, 203> tndOutput {
-            0,
-            0.00669982397969, 0.01334502018019, 0.01993625400950, 
-            0.02647418011241, 0.03295944258729, 0.03939267519756, 
-            0.04577450157816, 0.05210553543714, 0.05838638075230, 
-            0.06461763196336, 0.07079987415942, 0.07693368326217, 
-            0.08301962620469, 0.08905826110614, 0.09505013744241, 
-            0.10099579621273, 0.10689577010258, 0.11275058364270, 
-            0.11856075336460, 0.12432678795245, 0.13004918839154, 
-            0.13572844811339, 0.14136505313756, 0.14695948221033, 
-            0.15251220694025, 0.15802369193063, 0.16349439490917, 
-            0.16892476685466, 0.17431525212090, 0.17966628855794, 
-            0.18497830763061, 0.19025173453449, 0.19548698830939, 
-            0.20068448195030, 0.20584462251608, 0.21096781123563, 
-            0.21605444361197, 0.22110490952398, 0.22611959332601, 
-            0.23109887394543, 0.23604312497802, 0.24095271478145, 
-            0.24582800656677, 0.25066935848794, 0.25547712372958, 
-            0.26025165059283, 0.26499328257949, 0.26970235847437, 
-            0.27437921242602, 0.27902417402571, 0.28363756838493, 
-            0.28821971621118, 0.29277093388234, 0.29729153351946, 
-            0.30178182305810, 0.30624210631829, 0.31067268307303, 
-            0.31507384911547, 0.31944589632472, 0.32378911273039, 
-            0.32810378257583, 0.33239018638016, 0.33664860099905, 
-            0.34087929968434, 0.34508255214246, 0.34925862459181, 
-            0.35340777981888, 0.35753027723345, 0.36162637292260, 
-            0.36569631970379, 0.36974036717681, 0.37375876177487, 
-            0.37775174681463, 0.38171956254531, 0.38566244619686, 
-            0.38958063202731, 0.39347435136907, 0.39734383267453, 
-            0.40118930156071, 0.40501098085310, 0.40880909062876, 
-            0.41258384825848, 0.41633546844831, 0.42006416328027, 
-            0.42377014225228, 0.42745361231741, 0.43111477792243, 
-            0.43475384104561, 0.43837100123386, 0.44196645563923, 
-            0.44554039905471, 0.44909302394942, 0.45262452050314, 
-            0.45613507664028, 0.45962487806320, 0.46309410828495, 
-            0.46654294866144, 0.46997157842304, 0.47338017470566, 
-            0.47676891258120, 0.48013796508757, 0.48348750325813, 
-            0.48681769615063, 0.49012871087564, 0.49342071262454, 
-            0.49669386469696, 0.49994832852779, 0.50318426371374, 
-            0.50640182803940, 0.50960117750290, 0.51278246634113, 
-            0.51594584705452, 0.51909147043139, 0.52221948557194, 
-            0.52533003991180, 0.52842327924518, 0.53149934774765, 
-            0.53455838799856, 0.53760054100306, 0.54062594621377, 
-            0.54363474155206, 0.54662706342906, 0.54960304676622, 
-            0.55256282501566, 0.55550653018002, 0.55843429283219, 
-            0.56134624213454, 0.56424250585795, 0.56712321040049, 
-            0.56998848080581, 0.57283844078121, 0.57567321271550, 
-            0.57849291769646, 0.58129767552811, 0.58408760474768, 
-            0.58686282264231, 0.58962344526546, 0.59236958745312, 
-            0.59510136283973, 0.59781888387383, 0.60052226183351, 
-            0.60321160684160, 0.60588702788061, 0.60854863280746, 
-            0.61119652836797, 0.61383082021115, 0.61645161290323, 
-            0.61905900994148, 0.62165311376788, 0.62423402578250, 
-            0.62680184635674, 0.62935667484632, 0.63189860960408, 
-            0.63442774799265, 0.63694418639685, 0.63944802023592, 
-            0.64193934397562, 0.64441825114007, 0.64688483432350, 
-            0.64933918520172, 0.65178139454352, 0.65421155222187, 
-            0.65662974722489, 0.65903606766677, 0.66143060079845, 
-            0.66381343301815, 0.66618464988179, 0.66854433611320, 
-            0.67089257561425, 0.67322945147475, 0.67555504598228, 
-            0.67786944063185, 0.68017271613539, 0.68246495243116, 
-            0.68474622869301, 0.68701662333945, 0.68927621404268, 
-            0.69152507773743, 0.69376329062966, 0.69599092820525, 
-            0.69820806523840, 0.70041477580004, 0.70261113326609, 
-            0.70479721032554, 0.70697307898854, 0.70913881059424, 
-            0.71129447581863, 0.71344014468223, 0.71557588655763, 
-            0.71770177017702, 0.71981786363950, 0.72192423441843, 
-            0.72402094936854, 0.72610807473301, 0.72818567615049, 
-            0.73025381866193, 0.73231256671739, 0.73436198418274, 
-            0.73640213434624, 0.73843307992511, 0.74045488307187, 
-            0.74246760538076,
-        };
+        //Mixer tables (see apuMixer): the shared unity gain ones, or copies
+        //built for the gains set:
+        const s16* pulseLevels {apuMixer::pulseTable.data()};
+        const apuMixer::TndRow* tndLevels {apuMixer::tndTable.data()};
+        std::vector<s16> customPulseTable;
+        std::vector<apuMixer::TndRow> customTndTable;
+        std::array<double, MIXED> gains {{1, 1, 1, 1, 1}};
 
         //Miscellaneous lookup tables:
         const std::array<u16_fast, 16> noisePeriods {
@@ -1876,9 +1887,243 @@ class Apu {
             pulse.envelope.start = true;
         }
 
+        s32_fast mix() const {
+            return 
+                    pulseLevels[pulse1.output() << 4 | pulse2.output()]
+                  + tndLevels[triangle.output() << 4 | noise.output()][
+                            dmc.output()];
+        }
+
+        //Runs timer count ticks in one go, reloading it with period, and
+        //returns how many times it expired:
+        template <typename CounterType>
+        static u32_fast skipTimer(
+                Counter<CounterType>& timer,
+                const u32_fast period,
+                const u32_fast count) {
+            const u32_fast untilExpiry = timer.counter + 1;
+            if (count < untilExpiry) {
+                timer.counter -= count;
+                return 0;
+            }
+            const u32_fast past {count - untilExpiry};
+            timer.counter = period - past % (period + 1);
+            return 1 + past / (period + 1);
+        }
+
+        //Moves the pulse, triangle and noise channels count ticks on
+        //without synthesizing anything, leaving them just as running them
+        //would (nothing that changes their periods or gates happens in
+        //between, since that runs them first):
+        void skipChannels(const u32_fast count) {
+            for (Pulse* const pulse : {&pulse1, &pulse2}) {
+                const u32_fast expiries {skipTimer(
+                        pulse->timer, pulse->sweep.period * 2 + 1, count)};
+                pulse->sequencePos.counter =
+                        (pulse->sequencePos.counter + 8 - expiries % 8) % 8;
+            }
+
+            const u32_fast triangleSteps {skipTimer(
+                    triangle.timer, triangle.timer.reload, count)};
+            if (
+                    triangle.lengthCounter.counter.counter > 0
+                 && triangle.linearCounter.isNonZero()) {
+                //(the 32 step sequence: 0 to 15 ascending, then 15 to 0
+                //descending)
+                const u8_fast step = 
+                        (triangle.ascending 
+                              ? triangle.volume 
+                              : 31 - triangle.volume)
+                      + triangleSteps % 32;
+                triangle.ascending = step % 32 < 16;
+                triangle.volume = triangle.ascending 
+                      ? step % 32 
+                      : 31 - step % 32;
+            }
+
+            for (
+                    u32_fast shifts {skipTimer(
+                            noise.timer, noise.timer.reload, count)};
+                    shifts;
+                    --shifts) {
+                noise.timer.function();
+            }
+        }
+
+        //Each channel's output as if it were the only one playing:
+        std::array<s32_fast, MIXED> channelLevels() const {
+            return {{
+                    pulseLevels[pulse1.output() << 4],
+                    pulseLevels[pulse2.output()],
+                    tndLevels[triangle.output() << 4][0],
+                    tndLevels[noise.output()][0],
+                    tndLevels[0][dmc.output()]}};
+        }
+
+        //Adds steps for any change in output since the last call:
+        void addDeltas() {
+            const s32_fast level {mix()};
+            if (level != amplitude) {
+                blip.addDelta(channelTime, level - amplitude);
+                amplitude = level;
+            }
+
+            if (captureFunction) {
+                const std::array<s32_fast, MIXED> levels {channelLevels()};
+                for (u8_fast channel {0}; channel < MIXED; ++channel) {
+                    if (levels[channel] != channelAmplitudes[channel]) {
+                        channelBlips[channel].addDelta(
+                                channelTime,
+                                levels[channel] - channelAmplitudes[channel]);
+                        channelAmplitudes[channel] = levels[channel];
+                    }
+                }
+            }
+        }
+
+        //Runs the pulse, triangle and noise timers up to the current tick,
+        //stopping wherever one of them expires to pass output changes on
+        //(or, without audio, skipping straight there):
+        void runChannels() {
+            if (!audioEnabled) {
+                skipChannels(time - channelTime);
+                channelTime = time;
+            }
+            while (channelTime < time) {
+                u32_fast step {time - channelTime};
+                for (const s16_fast counter : {
+                        pulse1.timer.counter,
+                        pulse2.timer.counter,
+                        triangle.timer.counter,
+                        noise.timer.counter}) {
+                    step = std::min<u32_fast>(step, counter + 1);
+                }
+                pulse1.tick(step);
+                pulse2.tick(step);
+                triangle.tick(step);
+                noise.tick(step);
+                channelTime += step;
+
+                addDeltas();
+            }
+        }
+
+        //Passes on output changes made by anything other than the channel
+        //timers (register writes, frame counter, DMC):
+        void updateOutput() {
+            if (!audioEnabled) {
+                return;
+            }
+            runChannels();
+            addDeltas();
+        }
+
+        //Outputs count samples from ring, as up to 2 contiguous spans:
+        void outputSamples(const u32_fast count) {
+            for (u32_fast end {ringRead + count}; ringRead != end; ) {
+                const u32_fast span {std::min(
+                        end - ringRead,
+                        ringSize - ringRead % ringSize)};
+                outputFunction(ring.data() + ringRead % ringSize, span);
+                ringRead += span;
+            }
+        }
+
+        void endAudioFrame() {
+            runChannels();
+            if (audioEnabled) {
+                blip.endFrame(time);
+                if (captureFunction) {
+                    for (u8_fast channel {0}; channel < MIXED; ++channel) {
+                        BlipBuffer& channelBlip {channelBlips[channel]};
+                        channelBlip.endFrame(time);
+                        captureBuffer.resize(channelBlip.samplesAvailable());
+                        channelBlip.readSamples(
+                                captureBuffer.data(),
+                                captureBuffer.size());
+                        captureFunction(
+                                static_cast<Channel>(channel),
+                                captureBuffer.data(),
+                                captureBuffer.size());
+                    }
+                }
+            }
+            time = channelTime = 0;
+
+            while (blip.samplesAvailable()) {
+                //Make room rather than drop samples if nothing flushes:
+                if (ringWrite - ringRead == ringSize) {
+                    outputSamples(ringSize);
+                }
+                s16* const samples {ring.data() + ringWrite % ringSize};
+                const u32_fast count {blip.readSamples(
+                        samples,
+                        std::min(
+                                ringSize - ringWrite % ringSize,
+                                ringSize - (ringWrite - ringRead)))};
+                if (captureFunction) {
+                    captureFunction(MIXED, samples, count);
+                }
+                ringWrite += count;
+            }
+
+            if (blockSize) {
+                while (ringWrite - ringRead >= blockSize) {
+                    outputSamples(blockSize);
+                }
+            }
+        }
+
+        //Ticks until the next tick that does more than advance counters:
+        u32_fast cyclesUntilEvent() {
+            return std::min({
+                    frameCounter.cyclesUntilEvent(false),
+                    dmc.cyclesUntilFetch(),
+                    static_cast<u32_fast>(dmc.timer.counter + 1),
+                    static_cast<u32_fast>(audioFrameLength - time)});
+        }
+
+        //Runs count ticks, skipping in bulk over the quiet ones (the 
+        //channel timers are run separately by runChannels):
+        void run(u32_fast count) {
+            while (count) {
+                const u32_fast quiet {std::min(count, cyclesUntilEvent() - 1)};
+                time += quiet;
+                cycle += quiet;
+                frameCounter.cycle += quiet;
+                dmc.timer.counter -= quiet;
+                count -= quiet;
+
+                if (count) {
+                    timer.function();
+                    --count;
+                }
+            }
+        }
+
+        void updateDeadline() {
+            const u32_fast cycles {std::min({
+                    frameCounter.cyclesUntilEvent(true),
+                    dmc.cyclesUntilFetch(),
+                    static_cast<u32_fast>(audioFrameLength - time)})};
+            deadline = 
+                    timer.counter + 1 
+                  + (cycles - 1) * (timer.reload + 1);
+        }
+
     public:
-        //Function that outputs samples to the audio device:
-        std::function<void(u8 sample)> outputFunction {[] (u8) {}};
+        //Output samples per second:
+        static constexpr double sampleRate {1789772.727 / 30};
+
+        //Function that outputs blocks of samples to the audio device (the
+        //samples are only valid during the call):
+        std::function<void(
+                const s16* samples,
+                u32_fast count)> outputFunction {[] (const s16*, u32_fast) {}};
+        //Samples per call to outputFunction, or 0 to output samples only
+        //when flushAudio is called (a block may still arrive in 2 calls
+        //where it wraps around the ring buffer):
+        u32_fast blockSize {0};
 
         Apu(Cpu& cpu) 
               : cpu{cpu} { 
@@ -2090,26 +2335,43 @@ class Apu {
                     noise.lengthCounter.tick();
                 }
             };
-        }
 
-        Counter<s8_fast> output{29, [&] () {
-            outputFunction((pulseOutput[
-                           pulse1.output()
-                         + pulse2.output()]
-                     + tndOutput[
-                            3 * triangle.output()
-                          + 2 * noise.output()
-                          + dmc.output()]) * 0x100);
-        }};
+            //Register writes can change any channel's output, and they 
+            //and $4015 reads are where the APU's state is observed:
+            for (u16 address {0x4000}; address <= 0x4017; ++address) {
+                if (address == 0x4014 || address == 0x4016) {
+                    continue;
+                }
+                const auto write = cpu.memory.writeFunctions[address];
+                cpu.memory.writeFunctions[address] = [&, write] (
+                        MappedMemory<>* const memory,
+                        const u16 address,
+                        const u8 data) {
+                    catchUp();
+                    runChannels();
+                    write(memory, address, data);
+                    updateOutput();
+                    updateDeadline();
+                };
+            }
+            const auto statusRead = cpu.memory.readFunctions[0x4015];
+            cpu.memory.readFunctions[0x4015] = [&, statusRead] (
+                    MappedMemory<>* const memory,
+                    const u16 address) {
+                catchUp();
+                const u8 data = statusRead(memory, address);
+                updateDeadline();
+                return data;
+            };
+        }
 
         Counter<s16_fast> timer{0, [&] () {
-            pulse1.tick();
-            pulse2.tick();
-            triangle.tick();
-            noise.tick();
+            ++time;
             dmc.tick();
             frameCounter.tick();
-            output.tick();
+            if (time == audioFrameLength) {
+                endAudioFrame();
+            }
 
             ++cycle;
         }};
@@ -2124,261 +2386,243 @@ class Apu {
             dmc.volume &= 0x01;
         }
 
+        //Scales a channel's output (1 is normal). A group with any gain
+        //other than 1 gets its own copy of its mixer table, rebuilt here:
+        void setGain(const Channel channel, const double gain) {
+            catchUp();
+            runChannels();
+            gains[channel] = gain;
+            if (channel <= PULSE2) {
+                if (gains[PULSE1] == 1 && gains[PULSE2] == 1) {
+                    pulseLevels = apuMixer::pulseTable.data();
+                    std::vector<s16>().swap(customPulseTable);
+                }
+                else {
+                    customPulseTable.resize(apuMixer::pulseTableSize);
+                    for (u32_fast i {0}; i < customPulseTable.size(); ++i) {
+                        customPulseTable[i] = apuMixer::pulseLevel(
+                                i, gains[PULSE1], gains[PULSE2]);
+                    }
+                    pulseLevels = customPulseTable.data();
+                }
+            }
+            else {
+                if (
+                        gains[TRIANGLE] == 1 
+                     && gains[NOISE] == 1 
+                     && gains[DMC] == 1) {
+                    tndLevels = apuMixer::tndTable.data();
+                    std::vector<apuMixer::TndRow>().swap(customTndTable);
+                }
+                else {
+                    customTndTable.resize(apuMixer::tndTableSize);
+                    for (u32_fast row {0}; row < customTndTable.size(); ++row) {
+                        for (u32_fast dmc {0}; dmc < customTndTable[row].size();
+                                ++dmc) {
+                            customTndTable[row][dmc] = apuMixer::tndLevel(
+                                    row, dmc,
+                                    gains[TRIANGLE], gains[NOISE], gains[DMC]);
+                        }
+                    }
+                    tndLevels = customTndTable.data();
+                }
+            }
+            updateOutput();
+        }
+        double getGain(const Channel channel) const {
+            return gains[channel];
+        }
+
+        //Starts passing blocks of each channel's output (and the mix) to
+        //function (which needs audio enabled):
+        void startCapture(const std::function<void(
+                Channel channel,
+                const s16* samples,
+                u32_fast count)>& function) {
+            catchUp();
+            runChannels();
+            channelBlips.assign(MIXED, BlipBuffer {
+                    1789772.727, sampleRate, 1024});
+            channelAmplitudes.fill(0);
+            captureFunction = function;
+            addDeltas();
+        }
+        void stopCapture() {
+            captureFunction = nullptr;
+        }
+
+        //Whether to synthesize audio at all (without it, the channels are
+        //only kept in step, so the state is the same either way):
+        bool audioEnabled {true};
+
+        //Runs the APU up to the current master tick:
+        void catchUp() {
+            u32_fast cycles {0};
+            if (lag > static_cast<u32_fast>(timer.counter)) {
+                lag -= timer.counter + 1;
+                cycles = 1 + lag / (timer.reload + 1);
+                timer.counter = timer.reload - lag % (timer.reload + 1);
+            }
+            else {
+                timer.counter -= lag;
+            }
+            lag = 0;
+            run(cycles);
+
+            updateDeadline();
+        }
+
+        //The APU only runs when its state becomes observable: on register
+        //accesses, IRQs, DMC fetches and the ends of audio frames:
         void tick(const u8_fast ticks = 1) {
-            timer.tick(ticks);
+            lag += ticks;
+            if (lag >= deadline) {
+                catchUp();
+            }
         }
 
-        template <typename StateType>
-        void dumpState(StateType& state) {
-            //TODO: finish dump and load state methods
-            auto dump {[&] (const u8 data) {
-                //                  size in bytes
-                state.write(&data,              1);
-            }};
+        //Outputs all samples up to the current tick (once per video frame
+        //gives one block per frame):
+        void flushAudio() {
+            catchUp();
+            endAudioFrame();
+            updateDeadline();
+            if (!blockSize) {
+                outputSamples(ringWrite - ringRead);
+            }
+        }
+
+        //Savestate layout (see state-fields.hpp):
+        template <typename Fields>
+        void stateFields(Fields& fields) {
+            if (!fields.isLoading()) {
+                catchUp();
+                //(the channel timers are saved, so they have to be current)
+                runChannels();
+            }
 
-            dump(cycle & 0x000000FF);
-            dump(cycle >> 8 & 0x0000FF);
-            dump(cycle >> 16 & 0x00FF);
-            dump(cycle >> 24);
-
-            auto dumpPulse {[&] (const Pulse& pulse) {
-                dump(pulse.duty);
-                dump(pulse.ignoreEnvelope);
-                //Length counter:
-                    dump(pulse.lengthCounter.enabled);
-                    dump(pulse.lengthCounter.halt);
-                    dump(pulse.lengthCounter.counter.reload & 0x00FF);
-                    dump(pulse.lengthCounter.counter.reload >> 8);
-                    dump(pulse.lengthCounter.counter.counter & 0x00FF);
-                    dump(pulse.lengthCounter.counter.counter >> 8);
-                //Envelope:
-                    dump(pulse.envelope.start);
-                    dump(pulse.envelope.loop);
-                    dump(pulse.envelope.decayLevel.reload);
-                    dump(pulse.envelope.decayLevel.counter);
-                    dump(pulse.envelope.timer.reload);
-                    dump(pulse.envelope.timer.counter);
-                //Sweep:
-                    dump(pulse.sweep.reload);
-                    dump(pulse.sweep.enabled);
-                    dump(pulse.sweep.negate);
-                    dump(pulse.sweep.trueNegate);
-                    dump(pulse.sweep.shiftCount);
-                    dump(pulse.sweep.period & 0x00FF);
-                    dump(pulse.sweep.period >> 8);
-                    dump(pulse.sweep.timer.reload);
-                    dump(pulse.sweep.timer.counter);
-                dump(pulse.sequencePos.reload);
-                dump(pulse.sequencePos.counter);
-                dump(pulse.timer.reload & 0x00FF);
-                dump(pulse.timer.reload >> 8);
-                dump(pulse.timer.counter & 0x00FF);
-                dump(pulse.timer.counter >> 8);
+            fields.value("cycle", cycle, 4);
+
+            auto pulseFields {[&] (Pulse& pulse) {
+                fields.value("duty", pulse.duty, 1);
+                fields.value("ignoreEnvelope", pulse.ignoreEnvelope, 1);
+                fields.value(
+                        "lengthCounter.enabled", 
+                        pulse.lengthCounter.enabled, 1);
+                fields.value(
+                        "lengthCounter.halt", 
+                        pulse.lengthCounter.halt, 1);
+                fields.counter(
+                        "lengthCounter.counter", 
+                        pulse.lengthCounter.counter, 2);
+                fields.value("envelope.start", pulse.envelope.start, 1);
+                fields.value("envelope.loop", pulse.envelope.loop, 1);
+                fields.counter(
+                        "envelope.decayLevel", 
+                        pulse.envelope.decayLevel, 1);
+                fields.counter("envelope.timer", pulse.envelope.timer, 1);
+                fields.value("sweep.reload", pulse.sweep.reload, 1);
+                fields.value("sweep.enabled", pulse.sweep.enabled, 1);
+                fields.value("sweep.negate", pulse.sweep.negate, 1);
+                fields.value("sweep.trueNegate", pulse.sweep.trueNegate, 1);
+                fields.value("sweep.shiftCount", pulse.sweep.shiftCount, 1);
+                fields.value("sweep.period", pulse.sweep.period, 2);
+                fields.counter("sweep.timer", pulse.sweep.timer, 1);
+                fields.counter("sequencePos", pulse.sequencePos, 1);
+                fields.counter("timer", pulse.timer, 2);
             }};
-            dumpPulse(pulse1);
-            dumpPulse(pulse2);
+            fields.section("pulse1");
+            pulseFields(pulse1);
+            fields.section("pulse2");
+            pulseFields(pulse2);
             
-            dump(triangle.ascending);
-            dump(triangle.volume);
-            //Linear counter:
-                dump(triangle.linearCounter.reload);
-                dump(triangle.linearCounter.control);
-                dump(triangle.linearCounter.counter.reload & 0x00FF);
-                dump(triangle.linearCounter.counter.reload >> 8);
-                dump(triangle.linearCounter.counter.counter & 0x00FF);
-                dump(triangle.linearCounter.counter.counter >> 8);
-            //Length counter:
-                dump(triangle.lengthCounter.enabled);
-                dump(triangle.lengthCounter.halt);
-                dump(triangle.lengthCounter.counter.reload & 0x00FF);
-                dump(triangle.lengthCounter.counter.reload >> 8);
-                dump(triangle.lengthCounter.counter.counter & 0x00FF);
-                dump(triangle.lengthCounter.counter.counter >> 8);
-            dump(triangle.timer.reload & 0x00FF);
-            dump(triangle.timer.reload >> 8);
-            dump(triangle.timer.counter & 0x00FF);
-            dump(triangle.timer.counter >> 8);
-
-            dump(noise.mode);
-            dump(noise.ignoreEnvelope);
-            dump(noise.lfsr & 0x00FF);
-            dump(noise.lfsr >> 8);
-            //Length counter:
-                dump(noise.lengthCounter.enabled);
-                dump(noise.lengthCounter.halt);
-                dump(noise.lengthCounter.counter.reload & 0x00FF);
-                dump(noise.lengthCounter.counter.reload >> 8);
-                dump(noise.lengthCounter.counter.counter & 0x00FF);
-                dump(noise.lengthCounter.counter.counter >> 8);
-            //Envelope:
-                dump(noise.envelope.start);
-                dump(noise.envelope.loop);
-                dump(noise.envelope.decayLevel.reload);
-                dump(noise.envelope.decayLevel.counter);
-                dump(noise.envelope.timer.reload);
-                dump(noise.envelope.timer.counter);
-            dump(noise.timer.reload & 0x00FF);
-            dump(noise.timer.reload >> 8);
-            dump(noise.timer.counter & 0x00FF);
-            dump(noise.timer.counter >> 8);
-
-            dump(dmc.irqId);
-            dump(dmc.volume);
-            dump(dmc.irqEnabled);
-            dump(dmc.silence);
-            dump(dmc.enabled);
-            dump(dmc.finished);
-            dump(dmc.loop);
-            dump(dmc.shiftRegister);
-            dump(dmc.sampleBuffer & 0x00FF);
-            dump(dmc.sampleBuffer >> 8);
-            dump(dmc.startAddress & 0x00FF);
-            dump(dmc.startAddress >> 8);
-            dump(dmc.address & 0x00FF);
-            dump(dmc.address >> 8);
-
-            dump(frameCounter.cycle & 0x000000FF);
-            dump(frameCounter.cycle >> 8 & 0x0000FF);
-            dump(frameCounter.cycle >> 16 & 0x00FF);
-            dump(frameCounter.cycle >> 24);
-            dump(frameCounter.fourStep);
-            dump(frameCounter.interruptInhibit);
-            dump(frameCounter.irqId);
+            fields.section("triangle");
+            fields.value("ascending", triangle.ascending, 1);
+            fields.value("volume", triangle.volume, 1);
+            fields.value(
+                    "linearCounter.reload", 
+                    triangle.linearCounter.reload, 1);
+            fields.value(
+                    "linearCounter.control", 
+                    triangle.linearCounter.control, 1);
+            fields.counter(
+                    "linearCounter.counter", 
+                    triangle.linearCounter.counter, 2);
+            fields.value(
+                    "lengthCounter.enabled", 
+                    triangle.lengthCounter.enabled, 1);
+            fields.value(
+                    "lengthCounter.halt", 
+                    triangle.lengthCounter.halt, 1);
+            fields.counter(
+                    "lengthCounter.counter", 
+                    triangle.lengthCounter.counter, 2);
+            fields.counter("timer", triangle.timer, 2);
+
+            fields.section("noise");
+            fields.value("mode", noise.mode, 1);
+            fields.value("ignoreEnvelope", noise.ignoreEnvelope, 1);
+            fields.value("lfsr", noise.lfsr, 2);
+            fields.value(
+                    "lengthCounter.enabled", 
+                    noise.lengthCounter.enabled, 1);
+            fields.value(
+                    "lengthCounter.halt", 
+                    noise.lengthCounter.halt, 1);
+            fields.counter(
+                    "lengthCounter.counter", 
+                    noise.lengthCounter.counter, 2);
+            fields.value("envelope.start", noise.envelope.start, 1);
+            fields.value("envelope.loop", noise.envelope.loop, 1);
+            fields.counter(
+                    "envelope.decayLevel", 
+                    noise.envelope.decayLevel, 1);
+            fields.counter("envelope.timer", noise.envelope.timer, 1);
+            fields.counter("timer", noise.timer, 2);
+
+            fields.section("dmc");
+            fields.value("irqId", dmc.irqId, 1);
+            fields.value("volume", dmc.volume, 1);
+            fields.value("irqEnabled", dmc.irqEnabled, 1);
+            fields.value("silence", dmc.silence, 1);
+            fields.value("enabled", dmc.enabled, 1);
+            fields.value("finished", dmc.finished, 1);
+            fields.value("loop", dmc.loop, 1);
+            fields.value("shiftRegister", dmc.shiftRegister, 1);
+            fields.value("sampleBuffer", dmc.sampleBuffer, 2);
+            fields.value("startAddress", dmc.startAddress, 2);
+            fields.value("address", dmc.address, 2);
+            fields.counter("bytesRemaining", dmc.bytesRemaining, 2);
+            fields.counter("bitsRemaining", dmc.bitsRemaining, 1);
+            fields.counter("timer", dmc.timer, 2);
+
+            fields.section("frameCounter");
+            fields.value("cycle", frameCounter.cycle, 4);
+            fields.value("fourStep", frameCounter.fourStep, 1);
+            fields.value(
+                    "interruptInhibit", 
+                    frameCounter.interruptInhibit, 1);
+            fields.value("irqId", frameCounter.irqId, 1);
+
+            fields.section("");
+            //(where the next APU cycle falls between CPU cycles)
+            fields.value("timer.counter", timer.counter, 2);
+        }
+        template <typename StateType>
+        void dumpState(StateType& state) {
+            savestate::FieldWriter<StateType> fields {state};
+            stateFields(fields);
         }
-
         template <typename StateType>
         void loadState(StateType& state) {
-            u16 tmp;
-            auto load {[&] () {
-                u8 result;
-                //                  size in bytes 
-                state.read(&result,             1);
-                return result;
-            }};
-
-            cycle = load();
-            cycle |= load() << 8;
-            cycle |= load() << 16;
-            cycle |= load() << 24;
-
-            auto loadPulse {[&] (Pulse& pulse) {
-                pulse.duty = load();
-                pulse.ignoreEnvelope = load();
-                //Length counter:
-                    pulse.lengthCounter.enabled = load();
-                    pulse.lengthCounter.halt = load();
-                    tmp = load();
-                    tmp |= load() << 8;
-                    pulse.lengthCounter.counter.reload = toSigned(tmp); 
-                    tmp = load();
-                    tmp |= load() << 8;
-                    pulse.lengthCounter.counter.counter = toSigned(tmp);
-                //Envelope:
-                    pulse.envelope.start = load();
-                    pulse.envelope.loop = load();
-                    pulse.envelope.decayLevel.reload = toSigned(load());
-                    pulse.envelope.decayLevel.counter = toSigned(load());
-                    pulse.envelope.timer.reload = toSigned(load());
-                    pulse.envelope.timer.counter = toSigned(load());
-                //Sweep:
-                    pulse.sweep.reload = load();
-                    pulse.sweep.enabled = load();
-                    pulse.sweep.negate = load();
-                    pulse.sweep.trueNegate = load();
-                    pulse.sweep.shiftCount = load();
-                    pulse.sweep.period = load();
-                    pulse.sweep.period |= load() << 8;
-                    pulse.sweep.timer.reload = toSigned(load());
-                    pulse.sweep.timer.counter = toSigned(load());
-                pulse.sequencePos.reload = toSigned(load());
-                pulse.sequencePos.counter = toSigned(load());
-                tmp = load();
-                tmp |= load() << 8;
-                pulse.timer.reload = toSigned(tmp);
-                tmp = load();
-                tmp |= load() << 8;
-                pulse.timer.counter = toSigned(tmp);
-            }};
-            loadPulse(pulse1);
-            loadPulse(pulse2);
-
-            triangle.ascending = load();
-            triangle.volume = load();
-            //Linear counter:
-                triangle.linearCounter.reload = load(); 
-                triangle.linearCounter.control = load();
-                tmp = load();
-                tmp |= load() << 8;
-                triangle.linearCounter.counter.reload = toSigned(tmp);
-                tmp = load();
-                tmp |= load() << 8;
-                triangle.linearCounter.counter.counter = toSigned(tmp);
-            //Length counter:
-                triangle.lengthCounter.enabled = load();
-                triangle.lengthCounter.halt = load();
-                tmp = load();
-                tmp |= load() << 8;
-                triangle.lengthCounter.counter.reload = toSigned(tmp); 
-                tmp = load();
-                tmp |= load() << 8;
-                triangle.lengthCounter.counter.counter = toSigned(tmp);
-            tmp = load();
-            tmp |= load() << 8;
-            triangle.timer.reload = toSigned(tmp);
-            tmp = load();
-            tmp |= load() << 8;
-            triangle.timer.counter = toSigned(tmp);
-
-            noise.mode = load();
-            noise.ignoreEnvelope = load();
-            noise.lfsr = load();
-            noise.lfsr |= load() << 8;
-            //Length counter:
-                noise.lengthCounter.enabled = load();
-                noise.lengthCounter.halt = load();
-                tmp = load();
-                tmp |= load() << 8;
-                noise.lengthCounter.counter.reload = toSigned(tmp); 
-                tmp = load();
-                tmp |= load() << 8;
-                noise.lengthCounter.counter.counter = toSigned(tmp);
-            //Envelope:
-                noise.envelope.start = load();
-                noise.envelope.loop = load();
-                noise.envelope.decayLevel.reload = toSigned(load());
-                noise.envelope.decayLevel.counter = toSigned(load());
-                noise.envelope.timer.reload = toSigned(load());
-                noise.envelope.timer.counter = toSigned(load());
-            tmp = load();
-            tmp |= load() << 8;
-            noise.timer.reload = toSigned(tmp);
-            tmp = load();
-            tmp |= load() << 8;
-            noise.timer.counter = toSigned(tmp);
-
-            dmc.irqId = load();
-            dmc.volume = load();
-            dmc.irqEnabled = load();
-            dmc.silence = load();
-            dmc.enabled = load();
-            dmc.finished = load();
-            dmc.loop = load();
-            dmc.shiftRegister = load();
-            tmp = load();
-            tmp |= load() << 8;
-            dmc.sampleBuffer = toSigned(tmp);
-            dmc.startAddress = load();
-            dmc.startAddress |= load() << 8;
-            dmc.address = load();
-            dmc.address |= load() << 8;
-
-            frameCounter.cycle = load();
-            frameCounter.cycle |= load() << 8;
-            frameCounter.cycle |= load() << 16;
-            frameCounter.cycle |= load() << 24;
-            frameCounter.fourStep = load();
-            frameCounter.interruptInhibit = load();
-            frameCounter.irqId = load();
+            savestate::FieldReader<StateType> fields {state};
+            stateFields(fields);
+
+            //The loaded channels are already current:
+            channelTime = time;
+            updateOutput();
+            lag = 0;
+            updateDeadline();
         }
 };
 
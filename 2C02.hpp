@@ -1,10 +1,12 @@
 #include <array>
 #include <vector>
+#include <algorithm>
 #include <functional>
 #include "byte.hpp"
 //TODO: remove debug module
 #include "debug.hpp"
 #include "memory.hpp"
+#include "state-fields.hpp"
 #include "2A03.hpp"
 
 class Ppu {
@@ -43,10 +45,11 @@ class Ppu {
         bool renderSpritesFirstColumn {false};
         bool renderBackground {false};
         bool renderSprites {false};
-        //TODO: emphasis
         bool emphasizeRed {false};
         bool emphasizeGreen {false};
         bool emphasizeBlue {false};
+        //Emphasis bits (red, green, blue from bit 0) as a row of colors:
+        u16_fast emphasis {0};
 
         bool firstWrite {true}; 
 
@@ -58,6 +61,34 @@ class Ppu {
         u8_fast oamdata;
         u8_fast ppudata {0};
 
+        //Whether the current frame skips compositing and output:
+        bool skipping {false};
+
+        //Lazy evaluation:
+        //Master ticks elapsed since the PPU last ran:
+        u32_fast lag {0};
+        //Master ticks until the next NMI or frame boundary:
+        u32_fast deadline {0};
+        //Master ticks until $2002 could next read differently:
+        u32_fast statusDeadline {0};
+        //Scanline on or after each visible scanline on which sprite 
+        //evaluation could set the overflow flag (240 if none):
+        std::array<u8, 240> nextCrowdedScanline {};
+        bool oamChanged {true};
+
+        //OAM DMA (the bytes are read up front, while the CPU is halted, 
+        //and land in OAM as a scheduled event when the transfer ends):
+        std::array<u8, 256> oamDmaBuffer {};
+        //Master ticks until the pending OAM DMA ends (0 if none):
+        u32_fast oamDmaTicks {0};
+
+        void finishOamDma() {
+            for (const u8 data : oamDmaBuffer) {
+                primaryOam[oamaddr++] = data;
+            }
+            oamChanged = true;
+        }
+
         //Palette:
         const std::array<u8_fast, 192> palette {
                 0x5c, 0x5c, 0x5c, 0x00, 0x22, 0x67, 0x13, 0x12, 0x80, 
@@ -83,6 +114,11 @@ class Ppu {
                 0xb6, 0xe4, 0xea, 0xb0, 0xb0, 0xb0, 0x00, 0x00, 0x00, 
                 0x00, 0x00, 0x00,
         };
+        //Palette RAM ($3F10/$3F14/$3F18/$3F1C are kept in sync with 
+        //$3F00/$3F04/$3F08/$3F0C on write):
+        std::array<u8, 32> paletteRam {};
+        //Output color for each emphasis (row of 64) and palette index:
+        std::array<u32, 8 * 64> colors;
        
         //Miscellaneous operations:
         std::function<void()> idle {[] () {
@@ -111,6 +147,90 @@ class Ppu {
             }
         }
 
+        //Master ticks until the render loop reaches the given dot
+        //(may undershoot by one dot around the odd frame skip):
+        u32_fast ticksUntil(
+                const s16_fast targetScanline, 
+                const u16_fast targetDot) const {
+            s32_fast dots = (
+                    (targetScanline - scanline) * 341
+                  + static_cast<s32_fast>(targetDot)
+                  - static_cast<s32_fast>(dot))
+                  % (262 * 341);
+            if (dots < 0) {
+                dots += 262 * 341;
+            }
+            const u32_fast callbacks = dots > 0 ? dots : 1;
+            return 
+                    timer.counter + 1 
+                  + (callbacks - 1) * (timer.reload + 1);
+        }
+        void findCrowdedScanlines() {
+            std::array<u8_fast, 240> spriteCounts {};
+            const u8_fast spriteHeight = eightBySixteenSprites ? 16 : 8;
+            for (u8_fast i {0}; i < 64; ++i) {
+                for (
+                        u16_fast line = primaryOam[i * 4];
+                        line < primaryOam[i * 4] + spriteHeight && line < 240;
+                        ++line) {
+                    ++spriteCounts[line];
+                }
+            }
+            //8 sprites are enough for the misaligned overflow search:
+            u8_fast next {240};
+            for (s16_fast line {239}; line >= 0; --line) {
+                if (spriteCounts[line] >= 8) {
+                    next = line;
+                }
+                nextCrowdedScanline[line] = next;
+            }
+            oamChanged = false;
+        }
+        void updateDeadlines() {
+            deadline = std::min(ticksUntil(241, 1), ticksUntil(260, 340));
+            if (oamDmaTicks) {
+                deadline = std::min(deadline, oamDmaTicks);
+            }
+            //Every status flag but vblank is cleared on the pre-render line:
+            statusDeadline = std::min(deadline, ticksUntil(-1, 1));
+
+            //Predicted sprite 0 hit (OAM and rendering changes only 
+            //happen through registers, which rerun this prediction):
+            if (renderBackground && renderSprites && primaryOam[0] < 239) {
+                const s32_fast position = scanline * 341 + dot;
+                const s16_fast top = primaryOam[0] + 1;
+                const s16_fast bottom = 
+                        primaryOam[0] + (eightBySixteenSprites ? 16 : 8);
+                if (
+                        position >= top * 341 + primaryOam[3] + 1 
+                     && position <= bottom * 341 + 256) {
+                    statusDeadline = 0;
+                }
+                else {
+                    statusDeadline = std::min(
+                            statusDeadline, 
+                            ticksUntil(top, primaryOam[3] + 1));
+                }
+            }
+
+            //Earliest possible sprite overflow:
+            if ((renderBackground || renderSprites) && scanline <= 239) {
+                if (oamChanged) {
+                    findCrowdedScanlines();
+                }
+                const u8_fast line {nextCrowdedScanline[
+                        scanline < 0 ? 0 : scanline]};
+                if (line == scanline && dot >= 64) {
+                    statusDeadline = 0;
+                }
+                else if (line < 240) {
+                    statusDeadline = std::min(
+                            statusDeadline, 
+                            ticksUntil(line, 64));
+                }
+            }
+        }
+
         //Operation tables:
         const std::vector<std::vector<std::function<void()>>> operations {
             /*0: Initialize visible scanlines */ {
@@ -476,6 +596,21 @@ class Ppu {
         //Frame counter (no, not the APU):
         u32_fast frame {0};
 
+        //Composited pixels as palette indices (emphasis in bits 6-8), for
+        //video filters working from the NES's own colors:
+        std::array<u16, 256 * 240> indexedFrame {};
+
+        //Fast-forward (only 1 in every renderInterval frames is 
+        //composited and output, none if 0):
+        bool turbo {false};
+        u32_fast renderInterval {1};
+        bool frameSkipped {false};
+        //Skips compositing and output for the frame about to run, whatever
+        //turbo says (call between frames):
+        void skipFrame() {
+            skipping = true;
+        }
+
         std::function<void(
                 const u8_fast x, 
                 const u8_fast y, 
@@ -493,20 +628,6 @@ class Ppu {
                 u8_fast bgValue =
                         ((tileHigh >> fineXScroll & 1) << 1)
                       | (tileLow >> fineXScroll & 1);
-                u8_fast bgPixel {
-                        renderBackground 
-                     && (dot > 8 || renderBackgroundFirstColumn)
-                     && bgValue 
-                      ? memory[
-                                0x3F00
-                              | ((paletteHigh >> fineXScroll & 1) << 3)
-                              | ((paletteLow >> fineXScroll & 1) << 2)
-                              | bgValue]
-                      : address >= 0x3F00 && address <= 0x3FFF
-                     && !renderBackground && !renderSprites
-                      ? memory[address]
-                      : memory[0x3F00]};
-                bgPixel &= grayscaleMask;
 
                 u8_fast spriteValue {0};
                 bool spriteZero {false};
@@ -526,17 +647,6 @@ class Ppu {
                         }
                     }
                 }
-                u8_fast spritePixel {memory[
-                        0x3F10
-                      + (spritePalette << 2)
-                      + spriteValue]};
-                spritePixel &= grayscaleMask;
-
-                u8_fast pixel {
-                        spriteValue && !bgValue
-                     || spriteValue && bgValue && foregroundPriority
-                      ? spritePixel
-                      : bgPixel};
 
                 spriteZeroHit |= 
                         spriteZero && spriteValue && bgValue
@@ -545,10 +655,38 @@ class Ppu {
                      || dot > 8)
                      && dot <= 255;
 
-                outputFunction(dot - 1, scanline, 
-                        palette[pixel * 3    ] << 16 
-                      | palette[pixel * 3 + 1] << 8
-                      | palette[pixel * 3 + 2]);
+                //Skipped frames stop short of compositing:
+                if (!skipping) {
+                    u8_fast bgPixel {
+                            renderBackground 
+                         && (dot > 8 || renderBackgroundFirstColumn)
+                         && bgValue 
+                          ? paletteRam[
+                                    ((paletteHigh >> fineXScroll & 1) << 3)
+                                  | ((paletteLow >> fineXScroll & 1) << 2)
+                                  | bgValue]
+                          : address >= 0x3F00 && address <= 0x3FFF
+                         && !renderBackground && !renderSprites
+                          ? paletteRam[address & 0x1F]
+                          : paletteRam[0]};
+                    bgPixel &= grayscaleMask;
+
+                    u8_fast spritePixel {paletteRam[
+                            0x10
+                          + (spritePalette << 2)
+                          + spriteValue]};
+                    spritePixel &= grayscaleMask;
+
+                    u8_fast pixel {
+                            spriteValue && !bgValue
+                         || spriteValue && bgValue && foregroundPriority
+                          ? spritePixel
+                          : bgPixel};
+
+                    indexedFrame[scanline * 256 + dot - 1] = emphasis | pixel;
+                    outputFunction(dot - 1, scanline, 
+                            colors[emphasis | pixel]);
+                }
                 
                 //Sprite shifts:
                 for (u8_fast i {0}; i < 8; ++i) {
@@ -616,15 +754,55 @@ class Ppu {
                     ++frame;
                     scanline = -1;
                     operation = operations[0].begin(); 
+
+                    frameSkipped = skipping;
+                    skipping = 
+                            turbo 
+                         && (renderInterval == 0 || frame % renderInterval);
                 }
             }
         }};
 
+        //Runs the render loop for the given number of master ticks:
+        void run(u32_fast ticks) {
+            while (ticks > static_cast<u32_fast>(timer.counter)) {
+                ticks -= timer.counter + 1;
+                timer.counter = timer.reload;
+                timer.function();
+            }
+            timer.counter -= ticks;
+        }
+
+        //Runs the render loop up to the current master tick:
+        void catchUp() {
+            if (oamDmaTicks) {
+                if (lag >= oamDmaTicks) {
+                    run(oamDmaTicks);
+                    lag -= oamDmaTicks;
+                    oamDmaTicks = 0;
+                    finishOamDma();
+                }
+                else {
+                    oamDmaTicks -= lag;
+                }
+            }
+            run(lag);
+            lag = 0;
+
+            updateDeadlines();
+        }
+
+        //The PPU only runs when its state becomes observable: on register
+        //accesses, NMIs and frame boundaries:
         void tick(const u8_fast ticks = 1) {
-            timer.tick(ticks);
+            lag += ticks;
+            if (lag >= deadline) {
+                catchUp();
+            }
         }
 
         void reset() {
+            catchUp();
             cpu.memory[0x2000] = 0x00;
             cpu.memory[0x2001] = 0x00;
             cpu.memory[0x2005] = 0x00;
@@ -641,203 +819,146 @@ class Ppu {
 
             frame = 0;
             cycle = 0;
+
+            updateDeadlines();
         }
 
-        template <typename StateType>
-        void dumpState(StateType& state) {
-            auto dump {[&] (const u8 data) {
-                //                  size in bytes
-                state.write(&data,              1);
-            }};
-            
-            dump(dataLatch);
-
-            dump(startAddress & 0x00FF);
-            dump(startAddress >> 8);
-            dump(address & 0x00FF);
-            dump(address >> 8);
-            dump(fineXScroll);
-            dump(tileLow & 0x00FF);
-            dump(tileLow >> 8);
-            dump(tileHigh & 0x00FF);
-            dump(tileHigh >> 8);
-            dump(paletteLow & 0x00FF);
-            dump(paletteLow >> 8);
-            dump(paletteHigh & 0x00FF);
-            dump(paletteHigh >> 8);
-
-            dump(tileIndexLatch);
-            dump(paletteLatchLow);
-            dump(paletteLatchHigh);
-            dump(tileLatchLow);
-            dump(tileLatchHigh);
-
-            state.write(reinterpret_cast<const char*>(
-                    primaryOam.data()), 
-                    256);
-            state.write(reinterpret_cast<const char*>(
-                    secondaryOam.data()), 
-                    32);
-            state.write(reinterpret_cast<const char*>(
-                    tileLows.data()), 
-                    8);
-            state.write(reinterpret_cast<const char*>(
-                    tileHighs.data()), 
-                    8);
-            state.write(reinterpret_cast<const char*>(
-                    attributes.data()), 
-                    8);
-            state.write(reinterpret_cast<const char*>(
-                    xPositions.data()), 
-                    8);
-
-            dump(verticalPpuaddr);
-            dump(secondarySpritePatternTable);
-            dump(secondaryBackgroundPatternTable);
-            dump(eightBySixteenSprites);
+        //Savestate layout (see state-fields.hpp):
+        template <typename Fields>
+        void stateFields(Fields& fields) {
+            if (!fields.isLoading()) {
+                catchUp();
+            }
+
+            fields.section("registers");
+            fields.value("dataLatch", dataLatch, 1);
+            fields.value("startAddress", startAddress, 2);
+            fields.value("address", address, 2);
+            fields.value("fineXScroll", fineXScroll, 1);
+            fields.value("tileLow", tileLow, 2);
+            fields.value("tileHigh", tileHigh, 2);
+            fields.value("paletteLow", paletteLow, 2);
+            fields.value("paletteHigh", paletteHigh, 2);
+
+            fields.value("tileIndexLatch", tileIndexLatch, 1);
+            fields.value("paletteLatchLow", paletteLatchLow, 1);
+            fields.value("paletteLatchHigh", paletteLatchHigh, 1);
+            fields.value("tileLatchLow", tileLatchLow, 1);
+            fields.value("tileLatchHigh", tileLatchHigh, 1);
+
+            fields.block("primaryOam", primaryOam.data(), 256);
+            fields.block("secondaryOam", secondaryOam.data(), 32);
+            fields.block("tileLows", tileLows.data(), 8);
+            fields.block("tileHighs", tileHighs.data(), 8);
+            fields.block("attributes", attributes.data(), 8);
+            fields.block("xPositions", xPositions.data(), 8);
+
+            fields.value("verticalPpuaddr", verticalPpuaddr, 1);
+            fields.value(
+                    "secondarySpritePatternTable", 
+                    secondarySpritePatternTable, 1);
+            fields.value(
+                    "secondaryBackgroundPatternTable", 
+                    secondaryBackgroundPatternTable, 1);
+            fields.value("eightBySixteenSprites", eightBySixteenSprites, 1);
             //TODO: master/slave
-            dump(nmiEnabled);
-
-            dump(grayscaleMask);
-            dump(renderBackgroundFirstColumn);
-            dump(renderSpritesFirstColumn);
-            dump(renderBackground);
-            dump(renderSprites);
-            dump(emphasizeRed);
-            dump(emphasizeGreen);
-            dump(emphasizeBlue);
-
-            dump(firstWrite);
-
-            dump(spriteOverflow);
-            dump(spriteZeroHit);
-            dump(inVblank);
-
-            dump(oamaddr);
-            dump(oamdata);
-            dump(ppudata);
-
-            dump(n);
-            dump(m);
-            dump(spritesEvaluated);
-
-            dump(cycle & 0x000000FF);
-            dump(cycle >> 8 & 0x0000FF);
-            dump(cycle >> 16 & 0x00FF);
-            dump(cycle >> 24);
-            dump(frame & 0x000000FF);
-            dump(frame >> 8 & 0x0000FF);
-            dump(frame >> 16 & 0x00FF);
-            dump(frame >> 24);
-
-            state.write(reinterpret_cast<const char*>(
-                    memory.memory.data()),
-                    0x2000);
+            fields.value("nmiEnabled", nmiEnabled, 1);
+
+            fields.value("grayscaleMask", grayscaleMask, 1);
+            fields.value(
+                    "renderBackgroundFirstColumn", 
+                    renderBackgroundFirstColumn, 1);
+            fields.value(
+                    "renderSpritesFirstColumn", 
+                    renderSpritesFirstColumn, 1);
+            fields.value("renderBackground", renderBackground, 1);
+            fields.value("renderSprites", renderSprites, 1);
+            fields.value("emphasizeRed", emphasizeRed, 1);
+            fields.value("emphasizeGreen", emphasizeGreen, 1);
+            fields.value("emphasizeBlue", emphasizeBlue, 1);
+
+            fields.value("firstWrite", firstWrite, 1);
+
+            fields.value("spriteOverflow", spriteOverflow, 1);
+            fields.value("spriteZeroHit", spriteZeroHit, 1);
+            fields.value("inVblank", inVblank, 1);
+
+            fields.value("oamaddr", oamaddr, 1);
+            fields.value("oamdata", oamdata, 1);
+            fields.value("ppudata", ppudata, 1);
+
+            fields.section("rendering");
+            fields.value("dot", dot, 2);
+            fields.value("scanline", scanline, 2);
+            fields.value("n", n, 1);
+            fields.value("m", m, 1);
+            fields.value("spritesEvaluated", spritesEvaluated, 1);
+            //Operation iterators as (sequence, position):
+            auto operationFields {[&] (
+                    const char* const name,
+                    const std::vector<std::vector<std::function<void()>>>& 
+                            sequences,
+                    std::vector<std::function<void()>>::const_iterator&
+                            operation,
+                    u8_fast& step) {
+                u8_fast sequence {0};
+                while (
+                        operation < sequences[sequence].begin()
+                     || operation >= sequences[sequence].end()) {
+                    ++sequence;
+                }
+                u8_fast position = operation - sequences[sequence].begin();
+                fields.value(name, sequence, 1);
+                fields.value(name, position, 1);
+                fields.value(name, step, 1);
+                if (fields.isLoading()) {
+                    operation = sequences[sequence].begin() + position;
+                }
+            }};
+            operationFields("operation", operations, operation, operationStep);
+            operationFields(
+                    "spriteEvalOp",
+                    spriteEvalOps, 
+                    spriteEvalOp, 
+                    spriteEvalOpStep);
+
+            fields.value("cycle", cycle, 4);
+            fields.value("frame", frame, 4);
+
+            fields.section("memory");
+            //Palette RAM takes the place it used to have in PPU memory:
+            fields.block("vram", memory.memory.data(), 0x1F00);
+            fields.block("paletteRam", paletteRam.data(), 0x20);
+            fields.block("vram", memory.memory.data() + 0x1F20, 0xE0);
             
-            dump(timer.reload);
-            dump(timer.counter);
+            fields.section("timing");
+            fields.counter("timer", timer, 1);
+
+            fields.section("oamDma");
+            fields.value("oamDmaTicks", oamDmaTicks, 4);
+            fields.block("oamDmaBuffer", oamDmaBuffer.data(), 256);
+        }
+        template <typename StateType>
+        void dumpState(StateType& state) {
+            savestate::FieldWriter<StateType> fields {state};
+            stateFields(fields);
         }
         template <typename StateType>
         void loadState(StateType& state) {
-            auto load {[&] () {
-                u8 result;
-                //                  size in bytes
-                state.read(&result,             1);
-                return result;
-            }};
-
-            dataLatch = load();
-
-            startAddress = load();
-            startAddress |= load() << 8;
-            address = load();
-            address |= load() << 8;
-            fineXScroll = load();
-            tileLow = load();
-            tileLow |= load() << 8;
-            tileHigh = load();
-            tileHigh |= load() << 8;
-            paletteLow = load();
-            paletteLow |= load() << 8;
-            paletteHigh = load();
-            paletteHigh |= load() << 8;
-
-            tileIndexLatch = load();
-            paletteLatchLow = load();
-            paletteLatchHigh = load();
-            tileLatchLow = load();
-            tileLatchHigh = load();
-
-            state.read(reinterpret_cast<char*>(
-                    primaryOam.data()), 
-                    256);
-            state.read(reinterpret_cast<char*>(
-                    secondaryOam.data()), 
-                    32);
-            state.read(reinterpret_cast<char*>(
-                    tileLows.data()),
-                    8);
-            state.read(reinterpret_cast<char*>(
-                    tileHighs.data()),
-                    8);
-            state.read(reinterpret_cast<char*>(
-                    attributes.data()),
-                    8);
-            state.read(reinterpret_cast<char*>(
-                    xPositions.data()),
-                    8);
-
-            verticalPpuaddr = load();
-            secondarySpritePatternTable = load();
-            secondaryBackgroundPatternTable = load();
-            eightBySixteenSprites = load();
-            //TODO: master/slave
-            nmiEnabled = load();
-
-            grayscaleMask = load();
-            renderBackgroundFirstColumn = load();
-            renderSpritesFirstColumn = load();
-            renderBackground = load();
-            renderSprites = load();
-            emphasizeRed = load();
-            emphasizeGreen = load();
-            emphasizeBlue = load();
-
-            firstWrite = load();
-
-            spriteOverflow = load();
-            spriteZeroHit = load();
-            inVblank = load();
-
-            oamaddr = load();
-            oamdata = load();
-            ppudata = load();
-
-            dot = 0;
-            scanline = -1;
-            n = load();
-            m = load();
-            spritesEvaluated = load();
-            operation = operations[0].begin();
-            spriteEvalOp = spriteEvalOps[0].begin();
-            operationStep = 1;
-            spriteEvalOpStep = 1;
+            savestate::FieldReader<StateType> fields {state};
+            stateFields(fields);
+
+            emphasis = 
+                    (emphasizeRed 
+                  | emphasizeGreen << 1 
+                  | emphasizeBlue << 2) << 6;
+            for (u8_fast i {0x00}; i <= 0x0C; i += 0x04) {
+                paletteRam[i | 0x10] = paletteRam[i];
+            }
 
-            cycle = load();
-            cycle |= load() << 8;
-            cycle |= load() << 16;
-            cycle |= load() << 24;
-            frame = load();
-            frame |= load() << 8;
-            frame |= load() << 16;
-            frame |= load() << 24;
-
-            state.read(reinterpret_cast<char*>(
-                    memory.memory.data()), 
-                    0x2000);
-
-            timer.reload = toSigned(load());
-            timer.counter = toSigned(load());
+            lag = 0;
+            oamChanged = true;
+            updateDeadlines();
         }
 
         Ppu(Cpu& cpu) 
@@ -845,20 +966,31 @@ class Ppu {
             operation = operations[0].begin();
             spriteEvalOp = spriteEvalOps[0].begin();
 
-            memory.writeFunctions[0x3FFF] = [] (
+            //Emphasizing a color attenuates the other two:
+            for (u16_fast i {0}; i < colors.size(); ++i) {
+                colors[i] = 0;
+                for (u8_fast channel {0}; channel < 3; ++channel) {
+                    u32 value {palette[(i & 0x3F) * 3 + channel]};
+                    if ((i >> 6) & ~(1 << channel)) {
+                        value = value * 209 / 256;
+                    }
+                    colors[i] |= value << (16 - channel * 8);
+                }
+            }
+
+            memory.writeFunctions[0x3FFF] = [&] (
                     MappedMemory<>* const memory,
                     const u16 address,
                     const u8 data) {
-                memory->memory[
-                        (address & 0x1F1F)
-                      - ((address & 0x13) == 0x10 ? 0x10 : 0x00)] = data;
+                paletteRam[address & 0x1F] = data;
+                if (!(address & 0x03)) {
+                    paletteRam[(address & 0x1F) ^ 0x10] = data;
+                }
             };
-            memory.readFunctions[0x3FFF] = [] (
+            memory.readFunctions[0x3FFF] = [&] (
                     MappedMemory<>* const memory,
                     const u16 address) {
-                return memory->memory[
-                        (address & 0x1F1F)
-                      - ((address & 0x13) == 0x10 ? 0x10 : 0x00)];
+                return paletteRam[address & 0x1F];
             };
             memory.writeFunctions[0xFFFF] = [] (
                     MappedMemory<>* const memory,
@@ -886,18 +1018,23 @@ class Ppu {
                     MappedMemory<>* const memory,
                     const u16 address,
                     const u8 data) {
+                catchUp();
                 dataLatch = data;
                 setBit(startAddress, 10, data & 0x01); 
                 setBit(startAddress, 11, data & 0x02);
                 verticalPpuaddr = data & 0x04;
                 secondarySpritePatternTable = data & 0x08;
                 secondaryBackgroundPatternTable = data & 0x10;
+                if (eightBySixteenSprites != static_cast<bool>(data & 0x20)) {
+                    oamChanged = true;
+                }
                 eightBySixteenSprites = data & 0x20;
                 //TODO: master/slave
                 if (!nmiEnabled && data & 0x80 && inVblank) {
                     cpu.edgeNmi();
                 }
                 nmiEnabled = data & 0x80;
+                updateDeadlines();
             };
             cpu.memory.readFunctions[0x2000] = [&] (
                     MappedMemory<>* const memory,
@@ -908,6 +1045,7 @@ class Ppu {
                     MappedMemory<>* const memory,
                     const u16 address,
                     const u8 data) {
+                catchUp();
                 dataLatch = data;
                 grayscaleMask = data & 0x01 ? 0x30 : 0x3F;
                 renderBackgroundFirstColumn = data & 0x02;
@@ -917,6 +1055,8 @@ class Ppu {
                 emphasizeRed = data & 0x20;
                 emphasizeGreen = data & 0x40;
                 emphasizeBlue = data & 0x80;
+                emphasis = (data & 0xE0) << 1;
+                updateDeadlines();
             };
             cpu.memory.readFunctions[0x2001] = [&] (
                     MappedMemory<>* const memory,
@@ -932,6 +1072,11 @@ class Ppu {
             cpu.memory.readFunctions[0x2002] = [&] (
                     MappedMemory<>* const memory,
                     const u16 address) {
+                //Polling loops don't need the PPU to run until a flag 
+                //could actually change:
+                if (lag >= statusDeadline) {
+                    catchUp();
+                }
                 dataLatch &= 0x1F;
                 dataLatch |= spriteOverflow << 5;
                 dataLatch |= spriteZeroHit << 6;
@@ -955,14 +1100,18 @@ class Ppu {
                     MappedMemory<>* const memory,
                     const u16 address,
                     const u8 data) {
+                catchUp();
                 if (scanline >= 240 || (!renderBackground && !renderSprites)) {
                     primaryOam[oamaddr] = dataLatch = data; 
                     ++oamaddr;
+                    oamChanged = true;
+                    updateDeadlines();
                 }
             };
             cpu.memory.readFunctions[0x2004] = [&] (
                     MappedMemory<>* const memory,
                     const u16 address) {
+                catchUp();
                 if (scanline >= 240 || (!renderBackground && !renderSprites)) {
                     return dataLatch = primaryOam[oamaddr];
                 }
@@ -974,6 +1123,7 @@ class Ppu {
                     MappedMemory<>* const memory,
                     const u16,
                     const u8 data) {
+                catchUp();
                 dataLatch = data;
 
                 if (firstWrite) {
@@ -1000,6 +1150,7 @@ class Ppu {
                     MappedMemory<>* const memory,
                     const u16,
                     const u8 data) {
+                catchUp();
                 dataLatch = data;
 
                 if (firstWrite) {
@@ -1023,6 +1174,7 @@ class Ppu {
                     MappedMemory<>* const,
                     const u16,
                     const u8 data) {
+                catchUp();
                 memory[address] = dataLatch = data;
                 if (
                         (renderBackground || renderSprites)
@@ -1037,6 +1189,7 @@ class Ppu {
             cpu.memory.readFunctions[0x2007] = [&] (
                     MappedMemory<>* const,
                     const u16) {
+                catchUp();
                 if ((address & 0x3FFF) >= 0x3F00) {
                     dataLatch = memory[address] & grayscaleMask;
                     ppudata = memory[(address) - 0x1000]; 
@@ -1060,15 +1213,22 @@ class Ppu {
                     MappedMemory<>* const memory,
                     const u16 address,
                     const u8 data) {
-                cpu.timer.counter += 
-                        (513 + cpu.cycle % 2) 
-                      * (cpu.timer.reload + 1);
-                for (
-                        u16_fast i = data << 8;
-                        i < (data << 8) + 0x0100;
-                        ++i, ++oamaddr) {
-                    primaryOam[oamaddr] = cpu.memory[i];
+                catchUp();
+                const u16_fast page = data << 8;
+                if (page < 0x2000) {
+                    //Internal RAM is plain memory, so it is copied in bulk:
+                    const auto source = 
+                            cpu.memory.memory.begin() + (page & 0x07FF);
+                    std::copy(source, source + 0x0100, oamDmaBuffer.begin());
+                }
+                else {
+                    for (u16_fast i {0}; i < 0x0100; ++i) {
+                        oamDmaBuffer[i] = cpu.memory[page + i];
+                    }
                 }
+                oamDmaTicks = 
+                        cpu.haltForOamDma() * (cpu.timer.reload + 1);
+                updateDeadlines();
             };
         }
 };
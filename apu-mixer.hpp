@@ -0,0 +1,71 @@
+#pragma once
+#include <array>
+#include "byte.hpp"
+
+//The 2A03's nonlinear DAC as s16 lookup tables (each summing to at most
+//0x7FFF at unity gain). Channels sharing a DAC can't be mixed separately,
+//so each group's table is indexed by all of its channels' outputs, and 
+//per-channel gains are folded in by regenerating the tables:
+//  pulse:                     [pulse1 << 4 | pulse2]
+//  triangle, noise and DMC:   [triangle << 4 | noise][dmc]
+//(the TND table is built in rows, which keeps the compile-time parameter
+//packs short)
+namespace apuMixer {
+    constexpr u16_fast pulseTableSize {1 << 8};
+    constexpr u16_fast tndRowSize {1 << 7};
+    constexpr u16_fast tndTableSize {1 << 8};
+    using TndRow = std::array<s16, tndRowSize>;
+
+    //Approximations from nesdev.com/apu_ref.txt:
+    constexpr double pulseOutput(const double sum) {
+        return sum == 0 ? 0 : 95.52 / (8128 / sum + 100);
+    }
+    constexpr double tndOutput(const double sum) {
+        return sum == 0 ? 0 : 163.67 / (24329 / sum + 100);
+    }
+
+    constexpr s16 toLevel(const double output) {
+        return output >= 1 ? 0x7FFF : static_cast<s16>(output * 0x7FFF + 0.5);
+    }
+
+    constexpr s16 pulseLevel(
+            const u32_fast index,
+            const double pulse1Gain = 1,
+            const double pulse2Gain = 1) {
+        return toLevel(pulseOutput(
+                pulse1Gain * (index >> 4)
+              + pulse2Gain * (index & 0x0F)));
+    }
+    constexpr s16 tndLevel(
+            const u32_fast row,
+            const u32_fast dmc,
+            const double triangleGain = 1,
+            const double noiseGain = 1,
+            const double dmcGain = 1) {
+        return toLevel(tndOutput(
+                3 * triangleGain * (row >> 4)
+              + 2 * noiseGain * (row & 0x0F)
+              + dmcGain * dmc));
+    }
+
+    template <u32_fast... indices>
+    constexpr std::array<s16, sizeof...(indices)> makePulseTable(
+            Indices<indices...>) {
+        return {{pulseLevel(indices)...}};
+    }
+    template <u32_fast... indices>
+    constexpr TndRow makeTndRow(const u32_fast row, Indices<indices...>) {
+        return {{tndLevel(row, indices)...}};
+    }
+    template <u32_fast... indices>
+    constexpr std::array<TndRow, sizeof...(indices)> makeTndTable(
+            Indices<indices...>) {
+        return {{makeTndRow(indices, MakeIndices<tndRowSize>::type {})...}};
+    }
+
+    //Unity gain tables, built at compile time:
+    constexpr std::array<s16, pulseTableSize> pulseTable {
+            makePulseTable(MakeIndices<pulseTableSize>::type {})};
+    constexpr std::array<TndRow, tndTableSize> tndTable {
+            makeTndTable(MakeIndices<tndTableSize>::type {})};
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <cmath>
+#include <string>
+#include <vector>
+#include "byte.hpp"
+#include "nes-system.hpp"
+#include "wav-writer.hpp"
+
+//Records each APU channel and the mixed output of a Nes, for as long as
+//it exists, to prefix-pulse1.wav, prefix-pulse2.wav, prefix-triangle.wav,
+//prefix-noise.wav, prefix-dmc.wav and prefix-mixed.wav (at the APU's own
+//sample rate, before any resampling):
+class AudioCapture {
+    private:
+        Nes& nes;
+        WavWriter writer;
+
+        static std::vector<std::string> filenames(const std::string& prefix) {
+            std::vector<std::string> names;
+            for (const char* const channel : {
+                    "pulse1", "pulse2", "triangle", "noise", "dmc", "mixed"}) {
+                names.push_back(prefix + "-" + channel + ".wav");
+            }
+            return names;
+        }
+
+    public:
+        AudioCapture(Nes& nes, const std::string& prefix)
+              : nes{nes},
+                writer{filenames(prefix), static_cast<u32>(
+                        std::lround(nes.audioSampleRate))} {
+            nes.startAudioCapture([&] (
+                    const Apu::Channel channel,
+                    const s16* const samples,
+                    const u32_fast count) {
+                writer.write(channel, samples, count);
+            });
+        }
+
+        ~AudioCapture() {
+            nes.stopAudioCapture();
+        }
+
+        bool isOpen() const {
+            return writer.isOpen();
+        }
+};
@@ -0,0 +1,135 @@
+#pragma once
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <vector>
+#include "byte.hpp"
+
+//Band-limited step synthesis: a waveform is described by the times (in
+//source clock ticks) and sizes of its amplitude changes, each of which is
+//spread over nearby output samples as a windowed sinc impulse. Integrating
+//the buffer when samples are read turns the impulses back into steps,
+//without the aliasing of point sampling.
+class BlipBuffer {
+    private:
+        static constexpr u8_fast halfWidth {8};
+        static constexpr u8_fast phaseBits {6};
+        static constexpr u8_fast kernelBits {15};
+        //Fraction bits of sample positions:
+        static constexpr u8_fast fractionBits {32};
+        //Leak of the integrator (removes DC, cutoff around 20Hz):
+        static constexpr u8_fast bassShift {9};
+
+        //Impulse per sub-sample phase, as fixed point taps summing to 1:
+        std::array<std::array<s32, halfWidth * 2>, 1 << phaseBits> kernels;
+
+        std::vector<s64> buffer;
+        //Output samples per clock tick:
+        u64 factor;
+        //Position of the current frame's start in the buffer:
+        u64 offset {0};
+        s64 integrator {0};
+
+        void buildKernels() {
+            const double pi {3.14159265358979323846};
+            //Cutoff as a fraction of the sample rate, just below Nyquist:
+            const double cutoff {0.45};
+            for (u8_fast phase {0}; phase < kernels.size(); ++phase) {
+                std::array<double, halfWidth * 2> taps;
+                double sum {0};
+                for (u8_fast tap {0}; tap < taps.size(); ++tap) {
+                    const double t {
+                            tap - (halfWidth - 1.0)
+                          - static_cast<double>(phase) / kernels.size()};
+                    const double x {2 * pi * cutoff * t};
+                    const double sinc {x == 0 ? 1 : std::sin(x) / x};
+                    //Blackman window:
+                    const double w {pi * (t / halfWidth + 1)};
+                    const double window {
+                            0.42 - 0.5 * std::cos(w) + 0.08 * std::cos(2 * w)};
+                    taps[tap] = sinc * window;
+                    sum += taps[tap];
+                }
+
+                //Round so each impulse integrates to exactly 1 (otherwise
+                //steps would leave the output slowly drifting):
+                s32 total {0};
+                for (u8_fast tap {0}; tap < taps.size(); ++tap) {
+                    kernels[phase][tap] = std::lround(
+                            taps[tap] / sum * (1 << kernelBits));
+                    total += kernels[phase][tap];
+                }
+                kernels[phase][halfWidth - 1 + (phase >= kernels.size() / 2)]
+                        += (1 << kernelBits) - total;
+            }
+        }
+
+    public:
+        //capacity in output samples (the most that may pile up unread):
+        BlipBuffer(
+                const double clockRate,
+                const double sampleRate,
+                const u32_fast capacity)
+              : buffer(capacity + halfWidth * 2) {
+            buildKernels();
+            setRates(clockRate, sampleRate);
+        }
+
+        void setRates(const double clockRate, const double sampleRate) {
+            factor = std::llround(
+                    sampleRate / clockRate
+                  * static_cast<double>(u64 {1} << fractionBits));
+        }
+
+        //Adds an amplitude change at a time (in clock ticks) relative to
+        //the start of the current frame:
+        void addDelta(const u32_fast time, const s32_fast delta) {
+            const u64 position {offset + time * factor};
+            s64* const samples {buffer.data() + (position >> fractionBits)};
+            const std::array<s32, halfWidth * 2>& kernel {kernels[
+                    position >> (fractionBits - phaseBits)
+                  & ((1 << phaseBits) - 1)]};
+            for (u8_fast tap {0}; tap < kernel.size(); ++tap) {
+                samples[tap] += static_cast<s64>(kernel[tap]) * delta;
+            }
+        }
+
+        //Ends the current frame after duration clock ticks, making its
+        //samples available:
+        void endFrame(const u32_fast duration) {
+            offset += duration * factor;
+        }
+
+        u32_fast samplesAvailable() const {
+            return offset >> fractionBits;
+        }
+
+        //Reads up to count samples and returns how many were read:
+        u32_fast readSamples(s16* const output, const u32_fast count) {
+            const u32_fast read {std::min(count, samplesAvailable())};
+            for (u32_fast i {0}; i < read; ++i) {
+                integrator += buffer[i];
+                const s64 sample {integrator >> kernelBits};
+                integrator -= sample << (kernelBits - bassShift);
+                output[i] = std::max<s64>(-0x8000, std::min<s64>(0x7FFF, sample));
+            }
+
+            //Keep the tails of impulses that reach past the samples read:
+            std::copy(
+                    buffer.begin() + read,
+                    buffer.begin() + samplesAvailable() + halfWidth * 2,
+                    buffer.begin());
+            std::fill(
+                    buffer.begin() + samplesAvailable() - read + halfWidth * 2,
+                    buffer.begin() + samplesAvailable() + halfWidth * 2,
+                    0);
+            offset -= static_cast<u64>(read) << fractionBits;
+            return read;
+        }
+
+        void clear() {
+            std::fill(buffer.begin(), buffer.end(), 0);
+            offset = 0;
+            integrator = 0;
+        }
+};
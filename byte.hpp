@@ -91,6 +91,34 @@ s64 toSigned(u64 value) {
     }
 }
 
+//Compile-time index lists (for building constexpr tables from a pack 
+//expansion, in logarithmic template depth):
+template <u32_fast... indices>
+struct Indices {};
+
+template <typename, typename>
+struct ConcatIndices;
+template <u32_fast... first, u32_fast... second>
+struct ConcatIndices<Indices<first...>, Indices<second...>> {
+    using type = Indices<first..., (sizeof...(first) + second)...>;
+};
+
+//Indices from 0 to count - 1:
+template <u32_fast count>
+struct MakeIndices {
+    using type = typename ConcatIndices<
+            typename MakeIndices<count / 2>::type,
+            typename MakeIndices<count - count / 2>::type>::type;
+};
+template <>
+struct MakeIndices<0> {
+    using type = Indices<>;
+};
+template <>
+struct MakeIndices<1> {
+    using type = Indices<0>;
+};
+
 template <typename DataType>
 inline void setBit(DataType& data, u8_fast bit, bool value) {
     data &= ~(1 << bit);
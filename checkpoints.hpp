@@ -0,0 +1,333 @@
+#pragma once
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#ifdef OS_WINDOWS
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "byte.hpp"
+#include "state-fields.hpp"
+#include "nes-system.hpp"
+
+//Checkpoints of a long run in a memory-mapped file, so a run that's
+//killed (or loses power) can resume from the last one. The file holds
+//two slots: each state is saved to memory, then a background thread
+//copies it into the slot not holding the last good checkpoint, flushes
+//it to disk and only then switches the header over to it, so a crash at
+//any point leaves at least one intact checkpoint behind. (Saving isn't
+//done straight into the mapping since, once flushed, its pages fault on
+//the next write.) Layout (little endian):
+//  header (one page):
+//      magic      4 bytes  "NCKP"
+//      version    4 bytes
+//      slot size  4 bytes  capacity of each slot
+//      active     4 bytes  slot of the last good checkpoint (0 or 1), or
+//                          0xFFFFFFFF before the first
+//      then per slot:
+//          frame     4 bytes  caller's frame count when it was taken
+//          size      4 bytes  size of the state (0 if empty)
+//          checksum  8 bytes  hash of the state, to tell a slot that was
+//                             being written from an intact one
+//  slot 0, then slot 1, each page aligned and holding a state as saved
+//  by Nes::saveToBuffer
+class Checkpoints {
+    private:
+        static constexpr u32 magic {0x504B434E};
+        static constexpr u32 version {1};
+        static constexpr u32 noSlot {0xFFFFFFFF};
+        static constexpr size_t descriptorSize {16};
+
+#ifdef OS_WINDOWS
+        HANDLE file {INVALID_HANDLE_VALUE};
+        HANDLE mapping {nullptr};
+#else
+        int file {-1};
+#endif
+        u8* map {nullptr};
+        size_t pageSize;
+        size_t slotSize {0};
+        size_t mapSize {0};
+        //Slot holding the last good checkpoint:
+        u32 current {noSlot};
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable finished;
+        bool enabled {true};
+        bool pending {false};
+        //The checkpoint being flushed:
+        std::vector<u8> state;
+        u32 pendingFrame {0};
+        size_t pendingSize {0};
+        std::thread thread;
+
+        u8* slot(const u32 index) const {
+            return map + pageSize + index * slotSize;
+        }
+        u8* descriptor(const u32 index) const {
+            return map + 16 + index * descriptorSize;
+        }
+
+        static u64 checksum(u8* const data, const size_t size) {
+            savestate::FieldHasher hasher;
+            hasher.block("state", data, size);
+            return hasher.result();
+        }
+
+        //Writes size bytes from data (page aligned) through to disk:
+        void flush(u8* const data, const size_t size) {
+#ifdef OS_WINDOWS
+            FlushViewOfFile(data, size);
+            FlushFileBuffers(file);
+#else
+            msync(data, size, MS_SYNC);
+#endif
+        }
+
+        void syncer() {
+            std::unique_lock<std::mutex> lock {mutex};
+            while (true) {
+                wake.wait(lock, [&] () {
+                    return !enabled || pending;
+                });
+                if (!enabled) {
+                    return;
+                }
+
+                const u32 index {current == 1 ? 0u : 1u};
+                lock.unlock();
+                std::memcpy(slot(index), state.data(), pendingSize);
+                flush(slot(index), slotSize);
+                u8* const entry {descriptor(index)};
+                writeBytes<4>(entry + 0, pendingFrame);
+                writeBytes<4>(entry + 4, pendingSize);
+                savestate::splitBytes(
+                        checksum(slot(index), pendingSize), entry + 8, 8);
+                //(the switch: a single aligned store)
+                writeBytes<4>(map + 12, index);
+                flush(map, pageSize);
+                lock.lock();
+
+                current = index;
+                pending = false;
+                finished.notify_one();
+            }
+        }
+
+        //Maps the file at size bytes, returning false if it can't be:
+        bool mapFile(const size_t size) {
+            unmapFile();
+#ifdef OS_WINDOWS
+            LARGE_INTEGER end;
+            end.QuadPart = size;
+            if (
+                    !SetFilePointerEx(file, end, nullptr, FILE_BEGIN)
+                 || !SetEndOfFile(file)) {
+                return false;
+            }
+            mapping = CreateFileMappingA(
+                    file, nullptr, PAGE_READWRITE,
+                    static_cast<DWORD>(static_cast<u64>(size) >> 32),
+                    static_cast<DWORD>(size),
+                    nullptr);
+            if (!mapping) {
+                return false;
+            }
+            map = static_cast<u8*>(MapViewOfFile(
+                    mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+#else
+            if (ftruncate(file, size)) {
+                return false;
+            }
+            void* const address {mmap(
+                    nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    file, 0)};
+            map = address == MAP_FAILED ? nullptr : static_cast<u8*>(address);
+#endif
+            mapSize = map ? size : 0;
+            return map;
+        }
+        void unmapFile() {
+#ifdef OS_WINDOWS
+            if (map) {
+                UnmapViewOfFile(map);
+            }
+            if (mapping) {
+                CloseHandle(mapping);
+                mapping = nullptr;
+            }
+#else
+            if (map) {
+                munmap(map, mapSize);
+            }
+#endif
+            map = nullptr;
+            mapSize = 0;
+        }
+
+    public:
+        //Time the last save took on the calling thread, in microseconds
+        //(mostly the APU and PPU catching up to the present, which they'd
+        //do later anyway):
+        double cost {0};
+        //Saves skipped because the last checkpoint was still being
+        //flushed:
+        u32 skipped {0};
+
+        //Opens (or creates) a checkpoint file with room for nes's state
+        //(so for the cartridge loaded). A file made for a bigger or
+        //smaller state is emptied:
+        Checkpoints(const std::string& filename, Nes& nes) {
+#ifdef OS_WINDOWS
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            pageSize = info.dwAllocationGranularity;
+            file = CreateFileA(
+                    filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+                    nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE) {
+                return;
+            }
+            LARGE_INTEGER fileSize;
+            GetFileSizeEx(file, &fileSize);
+            const size_t existingSize = fileSize.QuadPart;
+#else
+            pageSize = sysconf(_SC_PAGESIZE);
+            file = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+            if (file < 0) {
+                return;
+            }
+            struct stat status;
+            fstat(file, &status);
+            const size_t existingSize = status.st_size;
+#endif
+            const size_t stateSize {nes.stateSize()};
+            slotSize = (stateSize + pageSize - 1) / pageSize * pageSize;
+            const size_t size {pageSize + 2 * slotSize};
+            if (!mapFile(size)) {
+                return;
+            }
+            if (
+                    existingSize != size
+                 || readBytes<4, u32>(map + 0) != magic
+                 || readBytes<4, u32>(map + 4) != version
+                 || readBytes<4, u32>(map + 8) != slotSize) {
+                std::memset(map, 0, pageSize);
+                writeBytes<4>(map + 0, magic);
+                writeBytes<4>(map + 4, version);
+                writeBytes<4>(map + 8, slotSize);
+                writeBytes<4>(map + 12, noSlot);
+                flush(map, pageSize);
+            }
+
+            state.resize(slotSize);
+            thread = std::thread([this] () {
+                syncer();
+            });
+        }
+        Checkpoints(const Checkpoints&) = delete;
+        Checkpoints& operator= (const Checkpoints&) = delete;
+
+        ~Checkpoints() {
+            if (thread.joinable()) {
+                finish();
+                mutex.lock();
+                enabled = false;
+                mutex.unlock();
+                wake.notify_all();
+                thread.join();
+            }
+            unmapFile();
+#ifdef OS_WINDOWS
+            if (file != INVALID_HANDLE_VALUE) {
+                CloseHandle(file);
+            }
+#else
+            if (file >= 0) {
+                close(file);
+            }
+#endif
+        }
+
+        bool isOpen() const {
+            return map;
+        }
+
+        //Loads the last good checkpoint and sets frame to the frame count
+        //saved with it, returning false if there's none:
+        bool restore(Nes& nes, u32& frame) {
+            finish();
+            const u32 active {readBytes<4, u32>(map + 12)};
+            if (active == noSlot) {
+                return false;
+            }
+            //(the other slot only if the active one is somehow damaged)
+            for (const u32 index : {active & 1, ~active & 1}) {
+                const u8* const entry {descriptor(index)};
+                const size_t size {readBytes<4, u32>(entry + 4)};
+                if (
+                        size
+                     && size <= slotSize
+                     && checksum(slot(index), size)
+                     == savestate::joinBytes(entry + 8, 8)
+                     && nes.loadFromBuffer(slot(index), size)) {
+                    frame = readBytes<4, u32>(entry + 0);
+                    current = index;
+                    if (index != active) {
+                        writeBytes<4>(map + 12, index);
+                        flush(map, pageSize);
+                    }
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        //Saves a checkpoint of nes, taken after frame frames, to be
+        //flushed in the background. Returns false, without saving, if the
+        //last one is still being flushed:
+        bool save(Nes& nes, const u32 frame) {
+            const auto startTime {std::chrono::steady_clock::now()};
+            std::unique_lock<std::mutex> lock {mutex};
+            if (pending) {
+                ++skipped;
+                return false;
+            }
+            lock.unlock();
+
+            const size_t size {nes.saveToBuffer(state.data(), state.size())};
+            if (size > state.size()) {
+                //(only if another cartridge was loaded since)
+                return false;
+            }
+
+            lock.lock();
+            pendingFrame = frame;
+            pendingSize = size;
+            pending = true;
+            lock.unlock();
+            wake.notify_one();
+
+            const std::chrono::duration<double, std::micro> elapsed {
+                    std::chrono::steady_clock::now() - startTime};
+            cost = elapsed.count();
+            return true;
+        }
+
+        //Waits for the checkpoint being flushed, if any:
+        void finish() {
+            std::unique_lock<std::mutex> lock {mutex};
+            finished.wait(lock, [&] () {
+                return !pending;
+            });
+        }
+};
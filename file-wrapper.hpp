@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdio>
+#include <ios>
+
+//std::FILE* handle shaped like a stream for Nes::load and Nes::loadNsf
+//(copies share the handle, and only the original closes it):
+struct FileWrapper {
+    std::FILE* data;
+    bool original;
+
+    FileWrapper(std::FILE* const data, const bool original = true)
+          : data{data}, original{original} {
+    }
+    FileWrapper(const FileWrapper& wrapper)
+          : data{wrapper.data}, original{false} {
+    }
+    FileWrapper& operator= (FileWrapper&& wrapper) {
+        data = wrapper.data;
+        wrapper.original = false;
+        original = true;
+
+        return *this;
+    }
+
+    void read(void* const ptr, const size_t size) {
+        std::fread(ptr, 1, size, data);
+    }
+    void write(const void* const ptr, const size_t size) {
+        std::fwrite(ptr, 1, size, data);
+    }
+    void seekg(const long offset, const std::ios::seekdir way) {
+        std::fseek(data, offset,
+                way == std::ios::beg
+              ? SEEK_SET
+              : way == std::ios::cur
+              ? SEEK_CUR
+              : SEEK_END);
+    }
+    void seekp(const long offset, const std::ios::seekdir way) {
+        seekg(offset, way);
+    }
+
+    ~FileWrapper() {
+        if (original && data) {
+            std::fclose(data);
+        }
+    }
+};
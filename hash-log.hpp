@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include "byte.hpp"
+#include "file-wrapper.hpp"
+#include "nes-system.hpp"
+
+//Logs the state hash (see Nes::stateHash) once per frame as
+//"<frame> <hash>" lines, so two runs can be compared frame by frame with
+//diff, and the first frame they disagree on inspected with
+//Nes::diffState.
+class HashLog {
+    private:
+        FileWrapper file;
+
+    public:
+        HashLog(const std::string& filename)
+              : file{std::fopen(filename.c_str(), "w")} {
+        }
+
+        bool isOpen() const {
+            return file.data;
+        }
+
+        //Call once per emulated frame:
+        void log(Nes& nes) {
+            log(nes.frame, nes.stateHash());
+        }
+        //Logs a hash taken earlier, after the given frame:
+        void log(const u32_fast frame, const u64 hash) {
+            std::fprintf(
+                    file.data,
+                    "%llu %016llx\n",
+                    static_cast<unsigned long long>(frame),
+                    static_cast<unsigned long long>(hash));
+        }
+};
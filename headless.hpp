@@ -0,0 +1,539 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include "byte.hpp"
+#include "file-wrapper.hpp"
+#include "ines.hpp"
+#include "nes-system.hpp"
+#include "lz.hpp"
+#include "audio-capture.hpp"
+#include "nsf-player.hpp"
+#include "run-ahead.hpp"
+#include "hash-log.hpp"
+#include "movie.hpp"
+#include "netplay.hpp"
+#include "checkpoints.hpp"
+
+//Runs a ROM as fast as possible without a window or audio device, for
+//tests and batch jobs:
+//  nessdl --headless <rom> [options]
+//      --frames <count>     frames to run (default 600)
+//      --sram <file>        battery save file (default none)
+//      --capture <prefix>   record each channel and the mix to WAV files
+//                           (see AudioCapture)
+//      --no-audio           skip audio synthesis entirely
+//      --bench-states <count>
+//                           afterwards, time count in-memory saves and 
+//                           loads (see Nes::saveToBuffer), and how well
+//                           the state compresses (see lz.hpp)
+//      --run-ahead <frames> run each frame ahead (see RunAhead) and report
+//                           what it costs
+//      --hash-log <file>    log the state hash after each frame (see
+//                           HashLog); the last one is always printed
+//      --movie <file>       play a movie (see Movie) instead of running
+//                           without input, for as many frames as it has,
+//                           and fail if the final state differs from the
+//                           one it recorded
+//      --fm2 <file>         play an FCEUX movie (see Movie::importFm2)
+//      --save-movie <file>  afterwards, save the movie played (or a movie
+//                           of the frames run without input) with the
+//                           final state, to check later runs against
+//      --netplay <player> <local port> <host:port>
+//                           play as player 1 or 2 against another
+//                           headless runner (see Netplay), with this
+//                           player's input from --movie or --fm2 (if
+//                           any), and report the rollbacks
+//      --max-rollback <frames>
+//                           most frames to run ahead of the other
+//                           player's input (default 8)
+//      --checkpoint <file>  checkpoint the run to a file (see Checkpoints),
+//                           resuming from it if it holds one
+//      --checkpoint-interval <frames>
+//                           frames between checkpoints (default 600)
+//or renders the songs of an NSF to WAV files (see NsfPlayer):
+//  nessdl --headless <nsf> [options]
+//      --song <number>      only render one song (default all)
+//      --seconds <length>   length of each song (default 150)
+//      --output <prefix>    write to <prefix>-<song>.wav (default "song")
+class Headless {
+    private:
+        Nes nes;
+
+        //(kept open for the cartridge to write battery saves to)
+        FileWrapper sram {nullptr};
+
+        void benchStates(const u32_fast count) {
+            std::vector<u8> state(nes.stateSize());
+            auto time {[&] (const std::function<void()>& function) {
+                const auto startTime {std::chrono::steady_clock::now()};
+                for (u32_fast i {0}; i < count; ++i) {
+                    function();
+                }
+                const std::chrono::duration<double, std::micro> elapsed {
+                        std::chrono::steady_clock::now() - startTime};
+                return elapsed.count() / count;
+            }};
+            const double saveTime {time([&] () {
+                nes.saveToBuffer(state.data(), state.size());
+            })};
+            const double loadTime {time([&] () {
+                nes.loadFromBuffer(state.data(), state.size());
+            })};
+            std::vector<u8> compressed(lz::maxCompressedSize(state.size()));
+            size_t compressedSize {0};
+            const double compressTime {time([&] () {
+                compressedSize = lz::compress(
+                        state.data(), state.size(), compressed.data());
+            })};
+            const double decompressTime {time([&] () {
+                lz::decompress(
+                        compressed.data(), compressedSize, 
+                        state.data(), state.size());
+            })};
+
+            std::cerr 
+                    << state.size() << " byte state: " 
+                    << saveTime << "us per save, " 
+                    << loadTime << "us per load\n"
+                    << compressedSize << " bytes compressed: " 
+                    << compressTime << "us per compress, " 
+                    << decompressTime << "us per decompress\n";
+        }
+
+    public:
+        //Returns whether the first argument selects the headless runner:
+        static bool isRequested(const int argc, char* argv[]) {
+            return argc > 1 && std::string {argv[1]} == "--headless";
+        }
+
+        int status {EXIT_SUCCESS};
+
+        Headless(const int argc, char* argv[]) {
+            if (argc < 3) {
+                std::cerr << "usage: nessdl --headless <rom> [options]\n";
+                status = EXIT_FAILURE;
+                return;
+            }
+            u32_fast frames {600};
+            std::string sramFilename;
+            std::string capturePrefix;
+            std::string hashLogFilename;
+            std::string movieFilename;
+            std::string fm2Filename;
+            std::string saveMovieFilename;
+            u8_fast netplayPlayer {0};
+            u16 netplayPort {0};
+            std::string netplayPeer;
+            u8_fast maxRollback {8};
+            std::string checkpointFilename;
+            u32_fast checkpointInterval {600};
+            bool audio {true};
+            u32_fast stateBenchCount {0};
+            RunAhead runAhead;
+            u16_fast song {0};
+            double seconds {150};
+            std::string outputPrefix {"song"};
+            //(the ones given that only apply to ROMs)
+            std::vector<std::string> romOptions;
+            for (int i {3}; i < argc; ++i) {
+                const std::string option {argv[i]};
+                const bool hasValue {i + 1 < argc};
+                if (option == "--frames" && hasValue) {
+                    frames = std::strtoul(argv[++i], nullptr, 10);
+                    romOptions.push_back(option);
+                }
+                else if (option == "--sram" && hasValue) {
+                    sramFilename = argv[++i];
+                    romOptions.push_back(option);
+                }
+                else if (option == "--capture" && hasValue) {
+                    capturePrefix = argv[++i];
+                    romOptions.push_back(option);
+                }
+                else if (option == "--hash-log" && hasValue) {
+                    hashLogFilename = argv[++i];
+                    romOptions.push_back(option);
+                }
+                else if (option == "--movie" && hasValue) {
+                    movieFilename = argv[++i];
+                    romOptions.push_back(option);
+                }
+                else if (option == "--fm2" && hasValue) {
+                    fm2Filename = argv[++i];
+                    romOptions.push_back(option);
+                }
+                else if (option == "--save-movie" && hasValue) {
+                    saveMovieFilename = argv[++i];
+                    romOptions.push_back(option);
+                }
+                else if (option == "--netplay" && i + 3 < argc) {
+                    netplayPlayer = std::strtoul(argv[++i], nullptr, 10);
+                    netplayPort = std::strtoul(argv[++i], nullptr, 10);
+                    netplayPeer = argv[++i];
+                    romOptions.push_back(option);
+                }
+                else if (option == "--max-rollback" && hasValue) {
+                    maxRollback = std::strtoul(argv[++i], nullptr, 10);
+                    romOptions.push_back(option);
+                }
+                else if (option == "--checkpoint" && hasValue) {
+                    checkpointFilename = argv[++i];
+                    romOptions.push_back(option);
+                }
+                else if (option == "--checkpoint-interval" && hasValue) {
+                    checkpointInterval = std::strtoul(argv[++i], nullptr, 10);
+                    romOptions.push_back(option);
+                }
+                else if (option == "--no-audio") {
+                    audio = false;
+                    romOptions.push_back(option);
+                }
+                else if (option == "--bench-states" && hasValue) {
+                    stateBenchCount = std::strtoul(argv[++i], nullptr, 10);
+                    romOptions.push_back(option);
+                }
+                else if (option == "--run-ahead" && hasValue) {
+                    runAhead.frames = std::strtoul(argv[++i], nullptr, 10);
+                    romOptions.push_back(option);
+                }
+                else if (option == "--song" && hasValue) {
+                    song = std::strtoul(argv[++i], nullptr, 10);
+                }
+                else if (option == "--seconds" && hasValue) {
+                    seconds = std::strtod(argv[++i], nullptr);
+                }
+                else if (option == "--output" && hasValue) {
+                    outputPrefix = argv[++i];
+                }
+                else {
+                    std::cerr << "invalid option " << option << "\n";
+                    status = EXIT_FAILURE;
+                    return;
+                }
+            }
+
+            FileWrapper rom {std::fopen(argv[2], "rb")};
+            if (rom.data && Cartridge::isNsf(rom)) {
+                const NsfHeader header {Cartridge::readNsfHeader(rom)};
+                if (header.error()) {
+                    std::cerr << header.error() << "\n";
+                    status = EXIT_FAILURE;
+                    return;
+                }
+                else if (song > header.songCount) {
+                    std::cerr << "invalid song " << song << "\n";
+                    status = EXIT_FAILURE;
+                    return;
+                }
+                std::cerr 
+                        << header.name << " - " << header.artist << " ("
+                        << static_cast<u16_fast>(header.songCount) 
+                        << " songs)\n";
+                for (const std::string& option : romOptions) {
+                    std::cerr << "ignoring " << option << " for an NSF\n";
+                }
+
+                const auto startTime {std::chrono::steady_clock::now()};
+                NsfPlayer player;
+                const std::vector<std::string> filenames {player.render(
+                        argv[2],
+                        outputPrefix,
+                        song ? song - 1 : 0,
+                        song ? song - 1 : header.songCount - 1,
+                        seconds)};
+                const std::chrono::duration<double> elapsed {
+                        std::chrono::steady_clock::now() - startTime};
+
+                std::cerr
+                        << filenames.size() << " songs in " 
+                        << elapsed.count() << "s (" 
+                        << filenames.size() * seconds / elapsed.count() 
+                        << "x real time)\n";
+                return;
+            }
+
+            if (sramFilename.empty()) {
+                sram = FileWrapper {std::tmpfile()};
+            }
+            else {
+                //(created if missing, without truncating)
+                std::FILE* const created {
+                        std::fopen(sramFilename.c_str(), "ab")};
+                if (created) {
+                    std::fclose(created);
+                    sram = FileWrapper {
+                            std::fopen(sramFilename.c_str(), "r+b")};
+                }
+            }
+            if (!rom.data) {
+                std::cerr << "invalid filename " << argv[2] << "\n";
+                status = EXIT_FAILURE;
+                return;
+            }
+            else if (!sram.data) {
+                std::cerr << "invalid filename " << sramFilename << "\n";
+                status = EXIT_FAILURE;
+                return;
+            }
+            else if (!Cartridge::isValid(rom)) {
+                std::cerr << "bad NES header\n";
+                status = EXIT_FAILURE;
+                return;
+            }
+            std::unique_ptr<Netplay> netplay;
+            if (netplayPlayer) {
+                const size_t colon {netplayPeer.rfind(':')};
+                if (
+                        netplayPlayer > 2
+                     || colon == std::string::npos
+                     || !saveMovieFilename.empty()
+                     || !checkpointFilename.empty()) {
+                    std::cerr << "invalid netplay options\n";
+                    status = EXIT_FAILURE;
+                    return;
+                }
+                netplay.reset(new Netplay {
+                        netplayPort,
+                        netplayPeer.substr(0, colon),
+                        static_cast<u16>(std::strtoul(
+                                netplayPeer.c_str() + colon + 1, 
+                                nullptr, 
+                                10)),
+                        netplayPlayer});
+                if (!netplay->isOpen()) {
+                    std::cerr << "cannot open netplay socket\n";
+                    status = EXIT_FAILURE;
+                    return;
+                }
+                netplay->maxRollback = maxRollback;
+            }
+
+            Movie movie;
+            const bool playing {
+                    !movieFilename.empty() || !fm2Filename.empty()};
+            if (!movieFilename.empty() && !movie.load(movieFilename)) {
+                std::cerr << "invalid movie " << movieFilename << "\n";
+                status = EXIT_FAILURE;
+                return;
+            }
+            else if (!fm2Filename.empty() && !movie.importFm2(fm2Filename)) {
+                std::cerr << "cannot import " << fm2Filename << "\n";
+                status = EXIT_FAILURE;
+                return;
+            }
+            nes.load(rom, sram);
+            nes.reset();
+            if (playing) {
+                if (!movie.start(nes)) {
+                    std::cerr << "damaged movie state\n";
+                    status = EXIT_FAILURE;
+                    return;
+                }
+                frames = movie.frames.size();
+            }
+            else {
+                movie.record(nes, true);
+            }
+
+            //Video is never composited:
+            nes.turbo = true;
+            nes.renderInterval = 0;
+            nes.audioEnabled = audio || !capturePrefix.empty();
+
+            std::unique_ptr<AudioCapture> capture;
+            if (!capturePrefix.empty()) {
+                capture.reset(new AudioCapture {nes, capturePrefix});
+                if (!capture->isOpen()) {
+                    std::cerr << "cannot write to " << capturePrefix << "\n";
+                    status = EXIT_FAILURE;
+                    return;
+                }
+            }
+            std::unique_ptr<HashLog> hashLog;
+            if (!hashLogFilename.empty()) {
+                hashLog.reset(new HashLog {hashLogFilename});
+                if (!hashLog->isOpen()) {
+                    std::cerr << "cannot write to " << hashLogFilename << "\n";
+                    status = EXIT_FAILURE;
+                    return;
+                }
+            }
+            std::unique_ptr<Checkpoints> checkpoints;
+            u32 firstFrame {0};
+            if (!checkpointFilename.empty()) {
+                checkpoints.reset(new Checkpoints {checkpointFilename, nes});
+                if (!checkpoints->isOpen()) {
+                    std::cerr 
+                            << "cannot write to " << checkpointFilename 
+                            << "\n";
+                    status = EXIT_FAILURE;
+                    return;
+                }
+                if (checkpoints->restore(nes, firstFrame)) {
+                    std::cerr << "resuming from frame " << firstFrame << "\n";
+                    if (!playing) {
+                        //(the frames before ran without input too)
+                        movie.frames.resize(firstFrame, {0, 0, 0});
+                    }
+                }
+            }
+
+            //Under netplay, frames are only logged once the other
+            //player's input for them is known, so a misprediction that
+            //gets rolled back never shows:
+            u32 loggedFrames {0};
+            auto logConfirmed {[&] () {
+                while (loggedFrames < netplay->confirmedFrames()) {
+                    u32_fast nesFrame;
+                    const u64 hash {netplay->frameHash(loggedFrames, nesFrame)};
+                    hashLog->log(nesFrame, hash);
+                    ++loggedFrames;
+                }
+            }};
+            if (netplay) {
+                netplay->hashFrames = static_cast<bool>(hashLog);
+            }
+
+            double runAheadCost {0};
+            double resimTime {0};
+            u32_fast checkpointCount {0};
+            double checkpointCost {0};
+            //Gives up on a peer that stops responding:
+            const std::chrono::seconds peerTimeout {10};
+            const auto startTime {std::chrono::steady_clock::now()};
+            for (u32_fast i {firstFrame}; i < frames; ++i) {
+                if (netplay) {
+                    //(resets in the movie aren't played)
+                    const u8 input {!playing 
+                          ? static_cast<u8>(0)
+                          : netplayPlayer == 1 
+                          ? movie.frames[i].controller1 
+                          : movie.frames[i].controller2};
+                    const auto deadline {
+                            std::chrono::steady_clock::now() + peerTimeout};
+                    for (bool ran {false}; !ran; ) {
+                        ran = netplay->advance(nes, input);
+                        resimTime += netplay->resimTime;
+                        if (std::chrono::steady_clock::now() > deadline) {
+                            std::cerr << "netplay peer stopped responding\n";
+                            status = EXIT_FAILURE;
+                            return;
+                        }
+                        if (!ran) {
+                            netplay->wait(1);
+                        }
+                    }
+                    if (hashLog) {
+                        logConfirmed();
+                    }
+                    continue;
+                }
+                if (playing) {
+                    movie.playFrame(nes, i);
+                }
+                else {
+                    movie.recordFrame(nes);
+                }
+                runAhead.runFrame(nes);
+                runAheadCost += runAhead.cost;
+                if (hashLog) {
+                    hashLog->log(nes);
+                }
+                if (
+                        checkpoints 
+                     && checkpointInterval 
+                     && (i + 1) % checkpointInterval == 0
+                     && checkpoints->save(nes, i + 1)) {
+                    ++checkpointCount;
+                    checkpointCost += checkpoints->cost;
+                }
+            }
+            if (checkpoints) {
+                checkpoints->finish();
+            }
+            if (netplay) {
+                //(ends on the same state as the peer)
+                const auto deadline {
+                        std::chrono::steady_clock::now() + peerTimeout};
+                while (!netplay->settle(nes)) {
+                    resimTime += netplay->resimTime;
+                    if (std::chrono::steady_clock::now() > deadline) {
+                        std::cerr << "netplay peer stopped responding\n";
+                        status = EXIT_FAILURE;
+                        break;
+                    }
+                    netplay->wait(1);
+                }
+                resimTime += netplay->resimTime;
+                if (hashLog) {
+                    logConfirmed();
+                }
+            }
+            const std::chrono::duration<double> elapsed {
+                    std::chrono::steady_clock::now() - startTime};
+
+            const u32_fast framesRun {
+                    frames > firstFrame ? frames - firstFrame : 0};
+            std::cerr
+                    << framesRun << " frames in " << elapsed.count() << "s ("
+                    << framesRun / elapsed.count() << " fps)\n";
+            if (runAhead.frames && framesRun) {
+                std::cerr
+                        << "running " 
+                        << static_cast<u16_fast>(runAhead.frames) 
+                        << " frames ahead: " << runAheadCost / framesRun 
+                        << "ms per frame\n";
+            }
+            if (checkpoints) {
+                std::cerr
+                        << checkpointCount << " checkpoints ("
+                        << (checkpointCount 
+                                ? checkpointCost / checkpointCount 
+                                : 0)
+                        << "us each on this thread), " 
+                        << checkpoints->skipped 
+                        << " skipped while one was being flushed\n";
+            }
+            if (netplay) {
+                std::cerr
+                        << netplay->rollbacks << " rollbacks (deepest "
+                        << netplay->maxRollbackDepth << " frames, "
+                        << (netplay->rollbacks 
+                                ? resimTime / netplay->rollbacks 
+                                : 0)
+                        << "ms each), " << netplay->stalls 
+                        << " stalls waiting for the other player\n";
+            }
+            std::cerr 
+                    << "state hash " << std::hex << std::setfill('0') 
+                    << std::setw(16) << nes.stateHash() << std::dec << "\n";
+            if (!movie.matches(nes)) {
+                std::cerr 
+                        << "movie ended in a different state (hash " 
+                        << std::hex << std::setfill('0') << std::setw(16) 
+                        << movie.finalHash << std::dec << ")\n";
+                status = EXIT_FAILURE;
+            }
+            if (!saveMovieFilename.empty()) {
+                movie.finish(nes);
+                if (!movie.save(saveMovieFilename)) {
+                    std::cerr 
+                            << "cannot write to " << saveMovieFilename 
+                            << "\n";
+                    status = EXIT_FAILURE;
+                }
+            }
+
+            if (stateBenchCount) {
+                benchStates(stateBenchCount);
+            }
+        }
+};
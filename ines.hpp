@@ -1,5 +1,7 @@
 #pragma once
 #include <cassert>
+#include <cmath>
+#include <algorithm>
 #include <string>
 #include <array>
 #include <vector>
@@ -8,12 +10,93 @@
 #include "debug.hpp"
 #include "byte.hpp"
 #include "memory.hpp"
+#include "state-fields.hpp"
+
+//NSF (NES Sound Format) header, from the first 0x80 bytes of the file:
+struct NsfHeader {
+    //"NESM" followed by $1A:
+    bool hasMagic;
+    u8_fast version;
+    u8_fast songCount;
+    //(1-based)
+    u8_fast startingSong;
+    u16_fast loadAddress;
+    u16_fast initAddress;
+    u16_fast playAddress;
+    std::string name;
+    std::string artist;
+    std::string copyright;
+    //Microseconds between PLAY calls:
+    u16_fast ntscSpeed;
+    //Initial 4KB banks at $8000 - $FFFF (all 0 if not bankswitched):
+    std::array<u8, 8> banks;
+    //Expansion audio (unsupported):
+    u8_fast soundChips;
+
+    NsfHeader(const std::array<u8, 0x80>& data) {
+        auto readString {[&] (const u8_fast offset) {
+            std::string string;
+            for (
+                    u8_fast i {offset};
+                    i < offset + 32 && data[i] != 0;
+                    ++i) {
+                string += static_cast<char>(data[i]);
+            }
+            return string;
+        }};
+
+        hasMagic =
+                readBytes<4, u32, Endianness::BIG>(data.begin()) == 0x4E45534D
+             && data[0x04] == 0x1A;
+        version = data[0x05];
+        songCount = data[0x06];
+        startingSong = data[0x07];
+        loadAddress = readBytes<2, u16>(data.begin() + 0x08);
+        initAddress = readBytes<2, u16>(data.begin() + 0x0A);
+        playAddress = readBytes<2, u16>(data.begin() + 0x0C);
+        name = readString(0x0E);
+        artist = readString(0x2E);
+        copyright = readString(0x4E);
+        ntscSpeed = readBytes<2, u16>(data.begin() + 0x6E);
+        std::copy(data.begin() + 0x70, data.begin() + 0x78, banks.begin());
+        soundChips = data[0x7B];
+    }
+
+    //Why the NSF can't be played, or nullptr if it can:
+    const char* error() const {
+        if (!hasMagic) {
+            return "bad NSF header";
+        }
+        else if (songCount == 0) {
+            return "NSF has no songs";
+        }
+        else if (startingSong < 1 || startingSong > songCount) {
+            return "NSF starting song out of range";
+        }
+        else if (loadAddress < 0x8000) {
+            return "NSF load address below $8000";
+        }
+        return nullptr;
+    }
+
+    bool isBankswitched() const {
+        for (const u8 bank : banks) {
+            if (bank) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
 
 class Cartridge {
     private:
         MappedMemory<>& cpuMemory;
         MappedMemory<>& ppuMemory;
 
+        //Master ticks since the NSF driver's last PLAY call:
+        u32_fast nsfElapsed {0};
+
     public:
         Cartridge(
                 MappedMemory<>& cpuMemory,
@@ -25,13 +108,26 @@ class Cartridge {
                 [] (const u8_fast) {
         }};
 
-        std::function<void(std::vector<u8>&)> dumpState {
-                [] (std::vector<u8>&) {
-        }};
-        std::function<void(const std::vector<u8>&)> loadState {
-                [] (const std::vector<u8>&) {
+        //Mapper state, declared by each mapper (see state-fields.hpp):
+        std::function<void(savestate::DynamicFields&)> mapperFields {
+                [] (savestate::DynamicFields&) {
         }};
-        u16_fast stateSize {0};
+
+        template <typename Fields>
+        void stateFields(Fields& fields) {
+            savestate::DynamicFields dynamicFields {fields};
+            mapperFields(dynamicFields);
+        }
+        template <typename StateType>
+        void dumpState(StateType& state) {
+            savestate::FieldWriter<StateType> fields {state};
+            stateFields(fields);
+        }
+        template <typename StateType>
+        void loadState(StateType& state) {
+            savestate::FieldReader<StateType> fields {state};
+            stateFields(fields);
+        }
 
         template <typename RomType>
         static bool isValid(RomType rom) {
@@ -44,6 +140,203 @@ class Cartridge {
             //        N.E.S... 
         }
 
+        template <typename RomType>
+        static bool isNsf(RomType rom) {
+            std::array<u8, 5> magic;
+            rom.read(reinterpret_cast<char*>(magic.begin()), 5);
+            rom.seekg(-5, std::ios::cur);
+            return 
+                    readBytes<4, u32, Endianness::BIG>(magic.begin())
+                 == 0x4E45534D
+            //        N.E.S.M
+                 && magic[4] == 0x1A;
+        }
+
+        template <typename RomType>
+        static NsfHeader readNsfHeader(RomType rom) {
+            std::array<u8, 0x80> header;
+            rom.read(reinterpret_cast<char*>(header.begin()), 0x80);
+            rom.seekg(-0x80, std::ios::cur);
+            return NsfHeader {header};
+        }
+
+        //Loads an NSF along with a driver that sets up the APU, calls INIT
+        //for a song (0-based), then calls PLAY at the NSF's rate:
+        template <typename RomType>
+        void loadNsf(RomType rom, const u8_fast song) {
+            const NsfHeader header {readNsfHeader(rom)};
+            rom.seekg(0x80, std::ios::cur);
+
+            //CPU memory is the usual 64KB (for RAM, the driver, bank
+            //registers and vectors), followed by all 256 possible 4KB
+            //banks of the program:
+            cpuMemory.memory.assign(0x10000 + 0x100 * 0x1000, 0);
+            const bool bankswitched {header.isBankswitched()};
+            //(the program starts at the load address's offset into the
+            //first bank, or into $8000 - $FFFF if not bankswitched)
+            const u16_fast padding = bankswitched
+                  ? header.loadAddress & 0x0FFF
+                  : (header.loadAddress - 0x8000) & 0x7FFF;
+            rom.read(reinterpret_cast<char*>(
+                    cpuMemory.memory.data() + 0x10000 + padding),
+                    0x100 * 0x1000 - padding);
+            for (u8_fast i {0}; i < 8; ++i) {
+                cpuMemory.memory[0x5FF8 + i] = bankswitched 
+                      ? header.banks[i] 
+                      : i;
+            }
+
+            //Driver (the flag at $41FF is set every PLAY period, and
+            //cleared when read):
+            const std::array<u8, 0x2A> driver {{
+                //reset:
+                    //Set up the stack:
+                    0xA2, 0xFF,                 //LDX #$FF
+                    0x9A,                       //TXS
+                    //Clear $4000 - $4013:
+                    0xA9, 0x00,                 //LDA #$00
+                    0xA2, 0x13,                 //LDX #$13
+                    0x9D, 0x00, 0x40,           //STA $4000,X
+                    0xCA,                       //DEX
+                    0x10, 0xFA,                 //BPL -6
+                    //Enable channels, disable the frame IRQ:
+                    0xA9, 0x0F,                 //LDA #$0F
+                    0x8D, 0x15, 0x40,           //STA $4015
+                    0xA9, 0x40,                 //LDA #$40
+                    0x8D, 0x17, 0x40,           //STA $4017
+                    //INIT(song, NTSC):
+                    0xA9, static_cast<u8>(song),//LDA #song
+                    0xA2, 0x00,                 //LDX #$00
+                    0x20, static_cast<u8>(header.initAddress),
+                          static_cast<u8>(header.initAddress >> 8),
+                //wait:
+                    0xAD, 0xFF, 0x41,           //LDA $41FF
+                    0xF0, 0xFB,                 //BEQ wait
+                    0x20, static_cast<u8>(header.playAddress),
+                          static_cast<u8>(header.playAddress >> 8),
+                    0x4C, 0x1E, 0x41,           //JMP wait
+                //interrupt:
+                    0x40,                       //RTI
+            }};
+            std::copy(
+                    driver.begin(), 
+                    driver.end(), 
+                    cpuMemory.memory.begin() + 0x4100);
+            //NMI, reset and IRQ vectors:
+            for (const u16_fast vector : {0xFFFA, 0xFFFC, 0xFFFE}) {
+                writeBytes<2>(
+                        cpuMemory.memory.begin() + vector, 
+                        vector == 0xFFFC ? 0x4100 : 0x4129);
+            }
+
+            cpuMemory.readFunctions[0x41FF] = [] (
+                    MappedMemory<>* const memory,
+                    const u16 address) {
+                if (address < 0x4100) {
+                    //TODO: Proper open bus read
+                    return static_cast<u8>(0);
+                }
+                const u8 data {memory->memory[address]};
+                if (address == 0x41FF) {
+                    memory->memory[address] = 0;
+                }
+                return data;
+            };
+            cpuMemory.writeFunctions[0x41FF] = [] (
+                    MappedMemory<>* const memory,
+                    const u16 address,
+                    const u8 data) {
+            };
+            cpuMemory.readFunctions[0x5FFF] = [] (
+                    MappedMemory<>* const memory,
+                    const u16 address) {
+                return static_cast<u8>(0);
+            };
+            //Bank registers:
+            cpuMemory.writeFunctions[0x5FFF] = [] (
+                    MappedMemory<>* const memory,
+                    const u16 address,
+                    const u8 data) {
+                if (address >= 0x5FF8) {
+                    memory->memory[address] = data;
+                }
+            };
+            //RAM:
+            cpuMemory.readFunctions[0x7FFF] = [] (
+                    MappedMemory<>* const memory,
+                    const u16 address) {
+                return memory->memory[address];
+            };
+            cpuMemory.writeFunctions[0x7FFF] = [] (
+                    MappedMemory<>* const memory,
+                    const u16 address,
+                    const u8 data) {
+                memory->memory[address] = data;
+            };
+            cpuMemory.readFunctions[0xFFFF] = [] (
+                    MappedMemory<>* const memory,
+                    const u16 address) {
+                if (address >= 0xFFFA) {
+                    return memory->memory[address];
+                }
+                return memory->memory[
+                        0x10000
+                      + memory->memory[0x5FF8 + (address >> 12 & 0x07)] 
+                            * 0x1000
+                      + (address & 0x0FFF)];
+            };
+            cpuMemory.writeFunctions[0xFFFF] = [] (
+                    MappedMemory<>* const memory,
+                    const u16 address,
+                    const u8 data) {
+            };
+
+            //Pattern table RAM and single-screen nametables (unused):
+            ppuMemory.resize(0x4000);
+            ppuMemory.readFunctions[0x1FFF] = [] (
+                    MappedMemory<>* const memory,
+                    const u16 address) {
+                return memory->memory[address + 0x2000];
+            };
+            ppuMemory.writeFunctions[0x1FFF] = [] (
+                    MappedMemory<>* const memory,
+                    const u16 address,
+                    const u8 data) {
+                memory->memory[address + 0x2000] = data;
+            };
+            ppuMemory.readFunctions[0x3EFF] = [] (
+                    MappedMemory<>* const memory,
+                    const u16 address) {
+                return memory->memory[address & 0x03FF];
+            };
+            ppuMemory.writeFunctions[0x3EFF] = [] (
+                    MappedMemory<>* const memory,
+                    const u16 address,
+                    const u8 data) {
+                memory->memory[address & 0x03FF] = data;
+            };
+
+            //PLAY timing (in master ticks, at 21.477272MHz):
+            const u32_fast period = std::lround(
+                    (header.ntscSpeed ? header.ntscSpeed : 16639) 
+                  * 21.4772727);
+            nsfElapsed = 0;
+            tick = [this, period] (const u8_fast ticks) {
+                nsfElapsed += ticks;
+                if (nsfElapsed >= period) {
+                    nsfElapsed -= period;
+                    cpuMemory.memory[0x41FF] = 1;
+                }
+            };
+            //(the bank registers, the PLAY timer and flag, and RAM)
+            mapperFields = [this] (savestate::DynamicFields& fields) {
+                fields.block("banks", cpuMemory.memory.data() + 0x5FF8, 8);
+                fields.value("playElapsed", nsfElapsed, 4);
+                fields.value("playFlag", cpuMemory.memory[0x41FF], 1);
+                fields.block("ram", cpuMemory.memory.data() + 0x6000, 0x2000);
+            };
+        }
+
         template <typename RomType, typename SramType>
         void load(RomType rom, SramType sram) {
             enum Mirroring : u8_fast {
@@ -157,9 +450,7 @@ class Cartridge {
                 };
 
                 tick = [] (const u8_fast) {};
-                dumpState = [] (std::vector<u8>&) {};
-                loadState = [] (const std::vector<u8>&) {};
-                stateSize = 0;
+                mapperFields = [] (savestate::DynamicFields&) {};
             break; }
 
             case 1: {
@@ -411,90 +702,35 @@ class Cartridge {
                         sram.seekp(-0x8000, std::ios::cur);
                     }
                 };
-                dumpState = [&, prgSize, chrRam] (
-                        std::vector<u8>& state) {
-                    std::vector<u8>::iterator data {state.begin()};
-
-                    *data++ = lastControlWriteCycle & 0x000000FF;
-                    *data++ = lastControlWriteCycle >> 8 & 0x0000FF;
-                    *data++ = lastControlWriteCycle >> 16 & 0x00FF;
-                    *data++ = lastControlWriteCycle >> 24;
-                    *data++ = lastSramWriteCycle & 0x000000FF;
-                    *data++ = lastSramWriteCycle >> 8 & 0x0000FF;
-                    *data++ = lastSramWriteCycle >> 16 & 0x00FF;
-                    *data++ = lastSramWriteCycle >> 24;
-                    *data++ = cycle & 0x000000FF;
-                    *data++ = cycle >> 8 & 0x0000FF;
-                    *data++ = cycle >> 16 & 0x00FF;
-                    *data++ = cycle >> 24;
-                    *data++ = shiftRegister;
-                    *data++ = shiftCount;
-                    *data++ = mmcMirroring;
-                    *data++ = prgMode;
-                    *data++ = contiguousChr;
-                    *data++ = chrBank0;
-                    *data++ = chrBank1;
-                    *data++ = prgRomBank;
-                    *data++ = prgRamBank;
-                    *data++ = prgRamEnable;
-
-                    std::copy(
-                            (cpuMemory.memory.data()
-                          + 0x8000
-                          + prgSize * 0x4000), 
-
-                            (cpuMemory.memory.data()
-                          + 0x10000
-                          + prgSize * 0x4000),
-
-                            data);
-                    data += 0x8000;
-                    if (chrRam) {
-                        std::copy(
-                                (ppuMemory.memory.data() + 0x2000),
-                                (ppuMemory.memory.data() + 0x4000),
-                                data);
-                    }
-                    data += 0x2000;
-                };
-                loadState = [&, prgSize, chrRam] (
-                        const std::vector<u8>& state) {
-                    std::vector<u8>::const_iterator data {state.begin()};
-
-                    lastControlWriteCycle = *data++;
-                    lastControlWriteCycle |= *data++ << 8;
-                    lastControlWriteCycle |= *data++ << 16;
-                    lastControlWriteCycle |= *data++ << 24;
-                    lastSramWriteCycle = *data++;
-                    lastSramWriteCycle |= *data++ << 8;
-                    lastSramWriteCycle |= *data++ << 16;
-                    lastSramWriteCycle |= *data++ << 24;
-                    cycle = *data++;
-                    cycle |= *data++ << 8;
-                    cycle |= *data++ << 16;
-                    cycle |= *data++ << 24;
-                    shiftRegister = *data++;
-                    shiftCount = *data++;
-                    mmcMirroring = *data++;
-                    prgMode = *data++;
-                    contiguousChr = *data++;
-                    chrBank0 = *data++;
-                    chrBank1 = *data++;
-                    prgRomBank = *data++;
-                    prgRamBank = *data++;
-                    prgRamEnable = *data++;
-
-                    std::copy(data, data += 0x8000,
-                            (cpuMemory.memory.data()
-                          + 0x8000
-                          + prgSize * 0x4000));
+                mapperFields = [&, prgSize, chrRam] (
+                        savestate::DynamicFields& fields) {
+                    fields.value(
+                            "lastControlWriteCycle", 
+                            lastControlWriteCycle, 4);
+                    fields.value("lastSramWriteCycle", lastSramWriteCycle, 4);
+                    fields.value("cycle", cycle, 4);
+                    fields.value("shiftRegister", shiftRegister, 1);
+                    fields.value("shiftCount", shiftCount, 1);
+                    fields.value("mmcMirroring", mmcMirroring, 1);
+                    fields.value("prgMode", prgMode, 1);
+                    fields.value("contiguousChr", contiguousChr, 1);
+                    fields.value("chrBank0", chrBank0, 1);
+                    fields.value("chrBank1", chrBank1, 1);
+                    fields.value("prgRomBank", prgRomBank, 1);
+                    fields.value("prgRamBank", prgRamBank, 1);
+                    fields.value("prgRamEnable", prgRamEnable, 1);
+
+                    fields.block(
+                            "prgRam",
+                            cpuMemory.memory.data() + 0x8000 + prgSize * 0x4000,
+                            0x8000);
                     if (chrRam) {
-                        std::copy(data, data += 0x2000,
-                                (ppuMemory.memory.data()
-                              + 0x2000));
+                        fields.block(
+                                "chrRam", 
+                                ppuMemory.memory.data() + 0x2000, 
+                                0x2000);
                     }
                 };
-                stateSize = 0x8000 + 22 + (chrRam ? 0x2000 : 0);
             break; }
             case 3: {
                 static u8_fast chrBank {0};
@@ -557,9 +793,9 @@ class Cartridge {
                 };
 
                 tick = [] (const u8_fast) {};
-                dumpState = [] (std::vector<u8>&) {};
-                loadState = [] (const std::vector<u8>&) {};
-                stateSize = 0;
+                mapperFields = [&] (savestate::DynamicFields& fields) {
+                    fields.value("chrBank", chrBank, 1);
+                };
             break; }
 
             default:
@@ -0,0 +1,227 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <array>
+#include "byte.hpp"
+
+//LZ77 compression in the style of LZ4 blocks, fast enough to run on
+//every savestate. A block is a series of sequences:
+//  token       1 byte   literal count (high nibble) and match length - 4
+//                       (low nibble), 15 meaning more follows
+//  [count]     n bytes  rest of the literal count: bytes added up until
+//                       one isn't 255
+//  literals    count bytes
+//  offset      2 bytes  how far back the match starts, or 0 for a run of
+//                       zeros (which savestates are full of)
+//  [length]    n bytes  rest of the match length, as for the count
+//The last sequence stops after its literals.
+namespace lz {
+    constexpr size_t minMatch {4};
+    constexpr size_t maxOffset {0xFFFF};
+    constexpr u8_fast hashBits {12};
+
+    //Most a block of size bytes can compress to:
+    constexpr size_t maxCompressedSize(const size_t size) {
+        return size + size / 255 + 16;
+    }
+
+    inline u32 read32(const u8* const data) {
+        u32 result;
+        std::memcpy(&result, data, 4);
+        return result;
+    }
+    inline u64 read64(const u8* const data) {
+        u64 result;
+        std::memcpy(&result, data, 8);
+        return result;
+    }
+
+    inline u8* writeLength(u8* out, size_t length) {
+        for (; length >= 255; length -= 255) {
+            *out++ = 255;
+        }
+        *out++ = length;
+        return out;
+    }
+    //(returns false if the block ends first)
+    inline bool readLength(
+            const u8*& in,
+            const u8* const end,
+            size_t& length) {
+        u8_fast byte;
+        do {
+            if (in == end) {
+                return false;
+            }
+            byte = *in++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+    //Writes a sequence of the literals [literals, literalEnd) and, unless
+    //matchLength is 0, a match:
+    inline u8* writeSequence(
+            u8* out,
+            const u8* const literals,
+            const u8* const literalEnd,
+            const size_t offset,
+            const size_t matchLength) {
+        const size_t count = literalEnd - literals;
+        const size_t extraLength {matchLength ? matchLength - minMatch : 0};
+        u8* const token {out++};
+        *token = (count < 15 ? count : 15) << 4
+               | (extraLength < 15 ? extraLength : 15);
+        if (count >= 15) {
+            out = writeLength(out, count - 15);
+        }
+        std::memcpy(out, literals, count);
+        out += count;
+        if (matchLength) {
+            writeBytes<2>(out, offset);
+            out += 2;
+            if (extraLength >= 15) {
+                out = writeLength(out, extraLength - 15);
+            }
+        }
+        return out;
+    }
+
+    //Compresses size bytes into out, which must hold
+    //maxCompressedSize(size), and returns the compressed size:
+    inline size_t compress(
+            const u8* const in,
+            const size_t size,
+            u8* const out) {
+        //Latest position of each hashed 4 byte sequence:
+        std::array<u32, 1 << hashBits> table {};
+        auto hash {[] (const u32 sequence) {
+            return sequence * 2654435761u >> (32 - hashBits);
+        }};
+
+        u8* data {out};
+        size_t anchor {0};
+        size_t position {0};
+        //(matches are found 8 bytes at a time, so stop short of the end)
+        while (position + 8 <= size) {
+            size_t matchStart {position};
+            size_t offset {0};
+            size_t length {0};
+
+            if (!read64(in + position)) {
+                length = 8;
+                while (
+                        position + length + 8 <= size
+                     && !read64(in + position + length)) {
+                    length += 8;
+                }
+            }
+            else {
+                u32& entry {table[hash(read32(in + position))]};
+                const size_t candidate {entry};
+                entry = position;
+                if (
+                        candidate < position
+                     && position - candidate <= maxOffset
+                     && read32(in + candidate) == read32(in + position)) {
+                    offset = position - candidate;
+                    length = minMatch;
+                }
+            }
+
+            if (!length) {
+                //Skips ahead faster the longer nothing matches:
+                position += 1 + ((position - anchor) >> 6);
+                continue;
+            }
+
+            //Extends the match both ways:
+            auto matches {[&] (const size_t i) {
+                return in[i] == (offset ? in[i - offset] : 0);
+            }};
+            while (position + length < size && matches(position + length)) {
+                ++length;
+            }
+            while (
+                    matchStart > anchor
+                 && (!offset || matchStart > offset)
+                 && matches(matchStart - 1)) {
+                --matchStart;
+            }
+
+            data = writeSequence(
+                    data,
+                    in + anchor,
+                    in + matchStart,
+                    offset,
+                    position + length - matchStart);
+            position += length;
+            anchor = position;
+        }
+        data = writeSequence(data, in + anchor, in + size, 0, 0);
+        return data - out;
+    }
+
+    //Decompresses a block into exactly size bytes, returning false if the
+    //block is damaged or doesn't decompress to that size:
+    inline bool decompress(
+            const u8* in,
+            const size_t compressedSize,
+            u8* const out,
+            const size_t size) {
+        const u8* const end {in + compressedSize};
+        u8* data {out};
+        const u8* const dataEnd {out + size};
+        while (in != end) {
+            const u8_fast token {*in++};
+
+            size_t count {static_cast<size_t>(token >> 4)};
+            if (count == 15 && !readLength(in, end, count)) {
+                return false;
+            }
+            if (
+                    count > static_cast<size_t>(end - in)
+                 || count > static_cast<size_t>(dataEnd - data)) {
+                return false;
+            }
+            if (count) {
+                std::memcpy(data, in, count);
+            }
+            data += count;
+            in += count;
+            if (in == end) {
+                break;
+            }
+
+            if (end - in < 2) {
+                return false;
+            }
+            const size_t offset {readBytes<2, size_t>(in)};
+            in += 2;
+            size_t length {static_cast<size_t>(token & 0x0F)};
+            if (length == 15 && !readLength(in, end, length)) {
+                return false;
+            }
+            length += minMatch;
+            if (
+                    length > static_cast<size_t>(dataEnd - data)
+                 || offset > static_cast<size_t>(data - out)) {
+                return false;
+            }
+            if (!offset) {
+                std::memset(data, 0, length);
+            }
+            else if (offset >= length) {
+                std::memcpy(data, data - offset, length);
+            }
+            else {
+                //(overlapping, so it repeats the last offset bytes)
+                for (size_t i {0}; i < length; ++i) {
+                    data[i] = data[i - offset];
+                }
+            }
+            data += length;
+        }
+        return data == dataEnd;
+    }
+}
@@ -1,6 +1,10 @@
 //TODO: const correctness
 #include "nessdl.hpp"
+#include "headless.hpp"
 
 int main(int argc, char* argv[]) {
+    if (Headless::isRequested(argc, argv)) {
+        return Headless {argc, argv}.status;
+    }
     Nessdl nessdl;
 }
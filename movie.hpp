@@ -0,0 +1,285 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "byte.hpp"
+#include "file-wrapper.hpp"
+#include "savestate.hpp"
+#include "state-fields.hpp"
+#include "lz.hpp"
+#include "nes-system.hpp"
+
+//Input movies: where to start (power-on, or a savestate) and the input
+//for every frame after it, so a run can be repeated exactly, e.g. to
+//benchmark or to check that a change doesn't alter emulation. Format
+//(little endian):
+//  magic       4 bytes  "NMOV"
+//  version     4 bytes
+//  flags       4 bytes  none defined yet (0)
+//  frames      4 bytes  number of frames
+//  final hash  8 bytes  Nes::stateHash after the last frame, or 0 if
+//                       unknown
+//  state size  4 bytes  size of the starting state, or 0 for power-on
+//  [length]    4 bytes  size of the compressed starting state (see lz.hpp)
+//  [state]     length bytes
+//  then per frame:
+//      controller1  1 byte   buttons held (as Nes::controller1)
+//      controller2  1 byte
+//      commands     1 byte   bit 0: reset before the frame
+class Movie {
+    public:
+        static constexpr u32 magic {0x564F4D4E};
+        static constexpr u32 version {1};
+        static constexpr u8 resetCommand {0x01};
+
+        struct Frame {
+            u8 controller1;
+            u8 controller2;
+            u8 commands;
+        };
+
+        //Uncompressed, as saved by Nes::saveToBuffer (empty for power-on):
+        std::vector<u8> startState;
+        std::vector<Frame> frames;
+        u64 finalHash {0};
+
+        //Starts recording from the current state, or from power-on if the
+        //ROM was only just loaded and reset:
+        void record(Nes& nes, const bool fromPowerOn) {
+            frames.clear();
+            finalHash = 0;
+            startState.clear();
+            if (!fromPowerOn) {
+                startState.resize(nes.stateSize());
+                nes.saveToBuffer(startState.data(), startState.size());
+            }
+        }
+        //Call before each frame is run, with the input it runs with:
+        void recordFrame(const Nes& nes, const u8 commands = 0) {
+            frames.push_back({
+                    static_cast<u8>(nes.controller1),
+                    static_cast<u8>(nes.controller2),
+                    commands});
+        }
+        //Call after the last frame to have playback check against it:
+        void finish(Nes& nes) {
+            finalHash = nes.stateHash();
+        }
+
+        //Loads the starting state, if any (power-on movies should be
+        //played right after the ROM is loaded and reset), returning false
+        //if it's damaged:
+        bool start(Nes& nes) const {
+            return
+                    startState.empty()
+                 || nes.loadFromBuffer(startState.data(), startState.size());
+        }
+        //Sets up the input of a frame (counted from the start) before it's
+        //run:
+        void playFrame(Nes& nes, const size_t index) const {
+            const Frame& frame {frames[index]};
+            if (frame.commands & resetCommand) {
+                nes.reset();
+            }
+            nes.controller1 = frame.controller1;
+            nes.controller2 = frame.controller2;
+        }
+        //Whether a final state matches the recorded one (true if there's
+        //nothing to compare):
+        bool matches(Nes& nes) const {
+            return !finalHash || nes.stateHash() == finalHash;
+        }
+
+        bool save(const std::string& filename) const {
+            FileWrapper file {std::fopen(filename.c_str(), "wb")};
+            if (!file.data) {
+                return false;
+            }
+            std::vector<u8> compressed(
+                    lz::maxCompressedSize(startState.size()));
+            const size_t compressedSize {startState.empty()
+                  ? 0
+                  : lz::compress(
+                            startState.data(),
+                            startState.size(),
+                            compressed.data())};
+
+            std::vector<u8> data(32 + compressedSize + frames.size() * 3);
+            writeBytes<4>(&data[0], magic);
+            writeBytes<4>(&data[4], version);
+            writeBytes<4>(&data[8], 0);
+            writeBytes<4>(&data[12], frames.size());
+            savestate::splitBytes(finalHash, &data[16], 8);
+            writeBytes<4>(&data[24], startState.size());
+            writeBytes<4>(&data[28], compressedSize);
+            u8* position {&data[32]};
+            if (compressedSize) {
+                std::memcpy(position, compressed.data(), compressedSize);
+                position += compressedSize;
+            }
+            for (const Frame& frame : frames) {
+                *position++ = frame.controller1;
+                *position++ = frame.controller2;
+                *position++ = frame.commands;
+            }
+            return
+                    std::fwrite(data.data(), 1, data.size(), file.data)
+                 == data.size();
+        }
+        //Returns false, leaving the movie empty, if it isn't one:
+        bool load(const std::string& filename) {
+            startState.clear();
+            frames.clear();
+            finalHash = 0;
+            FileWrapper file {std::fopen(filename.c_str(), "rb")};
+            if (!file.data) {
+                return false;
+            }
+            u8 header[32];
+            if (
+                    std::fread(header, 1, 32, file.data) != 32
+                 || readBytes<4, u32>(&header[0]) != magic
+                 || readBytes<4, u32>(&header[4]) != version) {
+                return false;
+            }
+            const u32 frameCount {readBytes<4, u32>(&header[12])};
+            const u32 stateSize {readBytes<4, u32>(&header[24])};
+            const u32 compressedSize {readBytes<4, u32>(&header[28])};
+            if (
+                    stateSize > savestate::maxSize
+                 || compressedSize > lz::maxCompressedSize(stateSize)
+                 || !stateSize != !compressedSize) {
+                return false;
+            }
+
+            if (stateSize) {
+                std::vector<u8> compressed(compressedSize);
+                startState.resize(stateSize);
+                if (
+                        std::fread(
+                                compressed.data(), 1, compressedSize,
+                                file.data)
+                     != compressedSize
+                     || !lz::decompress(
+                            compressed.data(), compressedSize,
+                            startState.data(), stateSize)) {
+                    startState.clear();
+                    return false;
+                }
+            }
+            //(read in pieces, so a bad count can't allocate much more
+            //than the file holds)
+            u8 data[3 * 4096];
+            while (frames.size() < frameCount) {
+                const size_t count {std::min<size_t>(
+                        frameCount - frames.size(), 4096)};
+                if (std::fread(data, 3, count, file.data) != count) {
+                    startState.clear();
+                    frames.clear();
+                    return false;
+                }
+                for (size_t i {0}; i < count; ++i) {
+                    frames.push_back({
+                            data[i * 3], data[i * 3 + 1], data[i * 3 + 2]});
+                }
+            }
+            finalHash = savestate::joinBytes(&header[16], 8);
+            return true;
+        }
+
+        //Imports an FCEUX movie: a text header of "key value" lines, then
+        //a line per frame, "|commands|RLDUTSBA|RLDUTSBA||", where any
+        //character but '.' or ' ' is a held button and commands 1 and 2
+        //are soft and hard resets. Only power-on movies with standard
+        //controllers can be imported, and FCEUX's frames don't start at
+        //quite the same point in the PPU's frame, so games that poll
+        //input mid-frame may play back differently. Returns false,
+        //leaving the movie empty, if it can't be imported:
+        bool importFm2(const std::string& filename) {
+            startState.clear();
+            frames.clear();
+            finalHash = 0;
+            FileWrapper file {std::fopen(filename.c_str(), "r")};
+            if (!file.data) {
+                return false;
+            }
+            auto parsePad {[] (
+                    const std::string& field,
+                    u8& buttons) {
+                //(an empty field is an unconnected port)
+                if (field.empty()) {
+                    buttons = 0;
+                    return true;
+                }
+                if (field.size() != 8) {
+                    return false;
+                }
+                buttons = 0;
+                for (u8_fast i {0}; i < 8; ++i) {
+                    //(RLDUTSBA, from bit 7 down to bit 0)
+                    buttons |= (field[i] != '.' && field[i] != ' ') << (7 - i);
+                }
+                return true;
+            }};
+
+            bool valid {true};
+            std::string line;
+            for (int character; valid; ) {
+                line.clear();
+                while (
+                        (character = std::fgetc(file.data)) != EOF
+                     && character != '\n') {
+                    if (character != '\r') {
+                        line += character;
+                    }
+                }
+                if (line.empty() && character == EOF) {
+                    break;
+                }
+
+                if (line[0] == '|') {
+                    std::vector<std::string> fields;
+                    size_t begin {1};
+                    for (
+                            size_t end {line.find('|', begin)};
+                            end != std::string::npos;
+                            end = line.find('|', begin)) {
+                        fields.push_back(line.substr(begin, end - begin));
+                        begin = end + 1;
+                    }
+                    Frame frame {0, 0, 0};
+                    valid =
+                            fields.size() >= 3
+                         && parsePad(fields[1], frame.controller1)
+                         && parsePad(fields[2], frame.controller2);
+                    if (valid) {
+                        frame.commands =
+                                std::strtoul(fields[0].c_str(), nullptr, 10)
+                              & 0x03
+                              ? resetCommand
+                              : 0;
+                        frames.push_back(frame);
+                    }
+                    continue;
+                }
+
+                const std::string key {line.substr(0, line.find(' '))};
+                const std::string value {line.size() > key.size()
+                      ? line.substr(key.size() + 1)
+                      : ""};
+                valid =
+                        !(key == "binary" && value != "0")
+                     && !(key == "palFlag" && value != "0")
+                     && !(key == "fourscore" && value != "0")
+                     && !(key == "savestate" && !value.empty())
+                     && !(key == "FDS" && value != "0");
+            }
+            if (!valid) {
+                frames.clear();
+            }
+            return valid;
+        }
+};
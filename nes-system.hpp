@@ -1,7 +1,13 @@
 #pragma once
+#include <vector>
+#include <string>
+#include <algorithm>
 #include <functional>
 #include "byte.hpp"
 #include "counter.hpp"
+#include "savestate.hpp"
+#include "state-fields.hpp"
+#include "lz.hpp"
 #include "ines.hpp"
 #include "2A03.hpp"
 #include "2C02.hpp"
@@ -16,15 +22,99 @@ class Nes {
         u8_fast controller1Button {0}, controller2Button {0};
         bool controllerStrobe {false};
 
+        //Savestates (see savestate.hpp), kept to be serialized into again:
+        std::vector<u8> stateBuffer;
+        std::vector<u8> compressedBuffer;
+
+        template <typename Fields>
+        void padFields(Fields& fields) {
+            fields.value("controller1Button", controller1Button, 1);
+            fields.value("controller2Button", controller2Button, 1);
+            fields.value("controllerStrobe", controllerStrobe, 1);
+        }
+
+        //Serializes the whole system in one pass and returns the size of 
+        //the state, which was only written if it fit in capacity:
+        size_t serialize(u8* const data, const size_t capacity) {
+            StateWriter state {data, capacity};
+            state.writeHeader();
+
+            state.beginChunk(savestate::tag("CPU "));
+            cpu.dumpState(state);
+            state.endChunk();
+            state.beginChunk(savestate::tag("APU "));
+            apu.dumpState(state);
+            state.endChunk();
+            state.beginChunk(savestate::tag("PPU "));
+            ppu.dumpState(state);
+            state.endChunk();
+            state.beginChunk(savestate::tag("CART"));
+            cart.dumpState(state);
+            state.endChunk();
+            state.beginChunk(savestate::tag("PADS"));
+            savestate::FieldWriter<StateWriter> fields {state};
+            padFields(fields);
+            state.endChunk();
+
+            state.finish();
+            return state.size();
+        }
+        //Returns false, without changing anything, if the state is damaged:
+        bool deserialize(const u8* const data, const size_t size) {
+            StateReader state {data, size};
+            if (!state.readHeader() || !state.isIntact()) {
+                return false;
+            }
+            u32 tag;
+            StateReader chunk {nullptr, 0};
+            //(chunks this version doesn't know are skipped)
+            while (state.nextChunk(tag, chunk)) {
+                switch (tag) {
+                case savestate::tag("CPU "):
+                    cpu.loadState(chunk);
+                break;
+                case savestate::tag("APU "):
+                    apu.loadState(chunk);
+                break;
+                case savestate::tag("PPU "):
+                    ppu.loadState(chunk);
+                break;
+                case savestate::tag("CART"):
+                    cart.loadState(chunk);
+                break;
+                case savestate::tag("PADS"): {
+                    savestate::FieldReader<StateReader> fields {chunk};
+                    padFields(fields);
+                break; }
+                }
+            }
+            return true;
+        }
+
     public:
-        std::function<void(u8 sample)>& audioOutputFunction {
+        std::function<void(
+                const s16* samples,
+                u32_fast count)>& audioOutputFunction {
                 apu.outputFunction};
+        u32_fast& audioBlockSize {apu.blockSize};
+        const double audioSampleRate {Apu::sampleRate};
+        //Turning audio off skips synthesis (see Apu):
+        bool& audioEnabled {apu.audioEnabled};
         std::function<void(
                 u8_fast x, 
                 u8_fast y, 
                 u32 pixel)>& videoOutputFunction {
                 ppu.outputFunction};
         u32_fast& frame {ppu.frame};
+        const std::array<u16, 256 * 240>& indexedFrame {ppu.indexedFrame};
+        //Fast-forward (see Ppu):
+        bool& turbo {ppu.turbo};
+        u32_fast& renderInterval {ppu.renderInterval};
+        const bool& frameSkipped {ppu.frameSkipped};
+        //For frames that are never shown (see Ppu::skipFrame):
+        void skipFrame() {
+            ppu.skipFrame();
+        }
         u8_fast controller1 {0}, controller2 {0};
 
         Nes() {
@@ -66,6 +156,23 @@ class Nes {
         template <typename RomType, typename SramType>
         void load(RomType rom, SramType sram) {
             cart.load(rom, sram);
+
+            //Bank switches and mirroring changes affect rendering, so 
+            //the PPU has to catch up before any mapper register write:
+            auto mapperWrite = cpu.memory.writeFunctions[0xFFFF];
+            cpu.memory.writeFunctions[0xFFFF] = [&, mapperWrite] (
+                    MappedMemory<>* const memory,
+                    const u16 address,
+                    const u8 data) {
+                ppu.catchUp();
+                mapperWrite(memory, address, data);
+            };
+        }
+
+        //Loads an NSF to play a song (0-based), see Cartridge::loadNsf:
+        template <typename RomType>
+        void loadNsf(RomType rom, const u8_fast song) {
+            cart.loadNsf(rom, song);
         }
 
         void reset() {
@@ -81,11 +188,33 @@ class Nes {
             cart.tick(ticks);
         }
 
+        void flushAudio() {
+            apu.flushAudio();
+        }
+
+        void setAudioGain(const Apu::Channel channel, const double gain) {
+            apu.setGain(channel, gain);
+        }
+        double getAudioGain(const Apu::Channel channel) const {
+            return apu.getGain(channel);
+        }
+
+        void startAudioCapture(const std::function<void(
+                Apu::Channel channel,
+                const s16* samples,
+                u32_fast count)>& function) {
+            apu.startCapture(function);
+        }
+        void stopAudioCapture() {
+            apu.stopCapture();
+        }
+
         void writeMemory(
                 const bool toPpu, 
                 const u16 address, 
                 const u8 data) {
             if (!toPpu || address <= 0x3FFF) {
+                ppu.catchUp();
                 MappedMemory<>& memory = toPpu ? ppu.memory : cpu.memory;
                 memory[address] = data;
             }
@@ -95,36 +224,149 @@ class Nes {
                 const u16 address) {
             int value {-1};
             if (!fromPpu || address <= 0x3FFF) {
+                ppu.catchUp();
                 MappedMemory<>& memory = fromPpu ? ppu.memory : cpu.memory;
                 value = memory[address];
             }
             return value;
         }
 
+        //Saves into a caller-owned buffer, without allocating or any I/O,
+        //and returns the size of the state (which was only written if it
+        //is at most capacity):
+        size_t saveToBuffer(u8* const data, const size_t capacity) {
+            return serialize(data, capacity);
+        }
+        //Returns false, without changing anything, if the state is damaged:
+        bool loadFromBuffer(const u8* const data, const size_t size) {
+            return deserialize(data, size);
+        }
+        //Capacity saveToBuffer needs for the loaded cartridge:
+        size_t stateSize() {
+            return serialize(nullptr, 0);
+        }
+
+        //Hash of everything a savestate holds, without saving one:
+        u64 stateHash() {
+            savestate::FieldHasher fields;
+            cpu.stateFields(fields);
+            apu.stateFields(fields);
+            ppu.stateFields(fields);
+            cart.stateFields(fields);
+            padFields(fields);
+            return fields.result();
+        }
+        //Lists the fields that differ from a state saved by saveToBuffer,
+        //e.g. "CPU.registers.a" (see savestate::FieldDiffer):
+        std::vector<std::string> diffState(
+                const u8* const data, 
+                const size_t size) {
+            std::vector<std::string> differences;
+            StateReader state {data, size};
+            if (!state.readHeader() || !state.isIntact()) {
+                differences.push_back("(damaged state)");
+                return differences;
+            }
+            u32 tag;
+            StateReader chunk {nullptr, 0};
+            while (state.nextChunk(tag, chunk)) {
+                const std::string name {
+                        reinterpret_cast<const char*>(&tag), 4};
+                savestate::FieldDiffer fields {
+                        chunk, 
+                        name.substr(0, name.find(' ')), 
+                        differences};
+                switch (tag) {
+                case savestate::tag("CPU "):
+                    cpu.stateFields(fields);
+                break;
+                case savestate::tag("APU "):
+                    apu.stateFields(fields);
+                break;
+                case savestate::tag("PPU "):
+                    ppu.stateFields(fields);
+                break;
+                case savestate::tag("CART"):
+                    cart.stateFields(fields);
+                break;
+                case savestate::tag("PADS"):
+                    padFields(fields);
+                break;
+                }
+            }
+            return differences;
+        }
+
+        //Writes a compressed savestate with a single write call:
         template <typename StateType>
         void dumpState(StateType& state) {
-            cpu.dumpState(state);
-            apu.dumpState(state);
-            ppu.dumpState(state);
+            size_t size {serialize(stateBuffer.data(), stateBuffer.size())};
+            if (size > stateBuffer.size()) {
+                stateBuffer.resize(size);
+                serialize(stateBuffer.data(), size);
+            }
 
-            std::vector<u8> cartState(cart.stateSize);
-            cart.dumpState(cartState);
-            state.write(cartState.data(), cart.stateSize); 
+            compressedBuffer.resize(
+                    savestate::compressedHeaderSize 
+                  + lz::maxCompressedSize(size));
+            u8* const header {compressedBuffer.data()};
+            const size_t compressedSize {lz::compress(
+                    stateBuffer.data(), 
+                    size, 
+                    header + savestate::compressedHeaderSize)};
+            writeBytes<4>(header + 0, savestate::compressedMagic);
+            writeBytes<4>(header + 4, size);
+            writeBytes<4>(header + 8, compressedSize);
+            state.write(
+                    header, 
+                    savestate::compressedHeaderSize + compressedSize);
         }
+        //Reads a savestate, returning false if it isn't one:
         template <typename StateType>
-        void loadState(StateType& state) {
-            cpu.loadState(state);
-            apu.loadState(state);
-            ppu.loadState(state);
+        bool loadState(StateType& state) {
+            u8 header[savestate::headerSize] {};
+            state.read(header, savestate::headerSize);
+            if (readBytes<4, u32>(header) == savestate::compressedMagic) {
+                const u32 size {readBytes<4, u32>(header + 4)};
+                const u32 compressedSize {readBytes<4, u32>(header + 8)};
+                if (
+                        size > savestate::maxSize
+                     || compressedSize > lz::maxCompressedSize(size)) {
+                    return false;
+                }
+                compressedBuffer.assign(compressedSize, 0);
+                state.read(compressedBuffer.data(), compressedSize);
+                stateBuffer.resize(size);
+                return
+                        lz::decompress(
+                                compressedBuffer.data(),
+                                compressedSize,
+                                stateBuffer.data(),
+                                size)
+                     && deserialize(stateBuffer.data(), size);
+            }
 
-            std::vector<u8> cartState(cart.stateSize);
-            state.read(cartState.data(), cart.stateSize);
-            cart.loadState(cartState);
+            const u32 size {readBytes<4, u32>(header + 8)};
+            if (
+                    readBytes<4, u32>(header) != savestate::magic
+                 || size < savestate::headerSize
+                 || size > savestate::maxSize) {
+                return false;
+            }
+            //(zeroed, so a truncated file fails the chunk checks)
+            stateBuffer.assign(size, 0);
+            std::copy(header, header + savestate::headerSize, 
+                    stateBuffer.begin());
+            state.read(
+                    stateBuffer.data() + savestate::headerSize, 
+                    size - savestate::headerSize);
+            return deserialize(stateBuffer.data(), size);
         }
 
         void ramdump(const char* const filename) {
             std::ofstream ramdumpFile {filename,
                     std::ofstream::binary | std::ofstream::trunc};
+            ppu.catchUp();
             auto ptr {ppu.memory.begin()};
             for (u32_fast i {0}; i <= 0x3FFF; ++i, ++ptr) {
                 u8 byte {*ptr};
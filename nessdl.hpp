@@ -7,25 +7,91 @@
 #include <vector>
 #include <functional>
 #include <unordered_map> 
+#include <atomic>
+#include <cstring>
 #include <iostream>
+#include <iomanip>
+#include <memory>
 #include <SDL2/SDL.h>
 #include "byte.hpp"
 #include "async-input.hpp"
 #include "memory.hpp"
 #include "ines.hpp"
 #include "nes-system.hpp"
+#include "worker-pool.hpp"
+#include "ntsc-filter.hpp"
+#include "upscaler.hpp"
+#include "resampler.hpp"
+#include "spsc-ring.hpp"
+#include "audio-capture.hpp"
+#include "state-slots.hpp"
+#include "rewind.hpp"
+#include "run-ahead.hpp"
+#include "hash-log.hpp"
+#include "movie.hpp"
+#include "netplay.hpp"
 
 class Nessdl {
     private:
         Nes nes;
+        WorkerPool workers;
+        NtscFilter ntscFilter{workers};
+        Upscaler upscaler{workers};
         AsyncInput asyncInput{std::cin, 10};
-        SDL_AudioDeviceID audioDevice;
+        SDL_AudioDeviceID audioDevice {0};
+        SDL_AudioSpec audioSpec;
+        //Sample rate and format fields as of the last openAudio:
+        int openedSampleRate;
+        std::string openedSampleFormat;
+        Resampler resampler;
+        //Whether the device is playing, or waiting for enough queued audio:
+        bool audioPlaying {false};
+        //Converted samples (as bytes of the device's format) waiting for
+        //the device's callback:
+        SpscRing<u8> audioRing {1 << 16};
+        std::atomic<u32_fast> audioUnderruns {0};
+        std::unique_ptr<AudioCapture> audioCapture;
+        StateSlots stateSlots;
+        Rewind rewind;
+        //Whether the rewind key is held:
+        bool rewinding {false};
+        RunAhead runAhead;
+        std::unique_ptr<HashLog> hashLog;
+        Movie movie;
+        std::string movieFilename;
+        bool recordingMovie {false};
+        bool playingMovie {false};
+        //Next frame of the movie being played:
+        size_t movieFrame {0};
+        //Commands (see Movie::Frame) to record with the next frame:
+        u8 movieCommands {0};
+        std::unique_ptr<Netplay> netplay;
+        //Netplay frames whose hashes have been logged:
+        u32 netplayLoggedFrames {0};
+        //Buttons held on each controller (passed on each frame, unless a
+        //movie or netplay says otherwise):
+        u8_fast pad1 {0}, pad2 {0};
+        //Most the resampling ratio is nudged by to steer latency:
+        const double maxRateAdjustment {0.005};
         SDL_Event event;
         SDL_Window* window;
         SDL_Renderer* renderer;
         SDL_Texture* texture;
+        //Upscaled output, by scale factor:
+        std::array<SDL_Texture*, 4> scaledTextures {};
+        //NTSC filtered output (768x240, stretched when it's drawn):
+        SDL_Texture* ntscTexture;
         u32* pixels;
         int pitch;
+        //Frames handed to the upscaler are rendered here (double buffered
+        //so the next frame can be emulated while one is being upscaled):
+        std::array<std::vector<u32>, 2> frameBuffers {{
+                std::vector<u32>(256 * 240), std::vector<u32>(256 * 240)}};
+        u8_fast frameBuffer {0};
+        //Samples converted for the audio device:
+        std::vector<s16> audioBuffer;
+        std::vector<float> floatAudioBuffer;
+        SDL_Texture* upscaledTexture {nullptr};
 
         std::array<SDL_Event, 16> buttonMap {};
 
@@ -76,9 +142,26 @@ class Nessdl {
             INT, FLOAT, STRING,
         };
         enum class Field : u16_fast {
-            AUDIO_BUFFER_MIN_SIZE,
+            AUDIO_LATENCY,
             FRAMES_REMAINING,
             PAUSED,
+            TURBO,
+            RENDER_INTERVAL,
+            NTSC_FILTER,
+            UPSCALER,
+            UPSCALE_TIME,
+            SAMPLE_RATE,
+            SAMPLE_FORMAT,
+            AUDIO_QUEUE,
+            AUDIO_UNDERRUNS,
+            AUDIO_OVERRUNS,
+            REWIND_INTERVAL,
+            REWIND_SNAPSHOTS,
+            RUN_AHEAD,
+            RUN_AHEAD_TIME,
+            MAX_ROLLBACK,
+            ROLLBACK_DEPTH,
+            RESIM_TIME,
         };
 
         template <typename DataType>
@@ -91,24 +174,75 @@ class Nessdl {
             return getField<DataType>(fieldFromString[name]);
         }
         std::vector<void*> fields {
-            //audio buffer min size:
-            new int(512),
+            //audio latency:
+            new int (32),
             //frames remaining:
             new int (0x7FFFFFFF),
             //paused:
             new int (1),
+            //turbo:
+            new int (0),
+            //render interval:
+            new int (1),
+            //NTSC filter:
+            new int (0),
+            //upscaler:
+            new int (0),
+            //upscale time:
+            new float (0),
+            //sample rate:
+            new int (48000),
+            //sample format:
+            new std::string ("s16"),
+            //audio queue:
+            new float (0),
+            //audio underruns:
+            new int (0),
+            //audio overruns:
+            new int (0),
+            //rewind interval:
+            new int (1),
+            //rewind snapshots:
+            new int (0),
+            //run ahead:
+            new int (0),
+            //run ahead time:
+            new float (0),
+            //max rollback:
+            new int (8),
+            //rollback depth:
+            new int (0),
+            //resim time:
+            new float (0),
         };
         std::unordered_map<std::string, Type> fieldTypes {
-            {"audio_buffer_min_size", Type::INT}, 
+            {"audio_latency", Type::INT},
             {"frames_remaining", Type::INT},
             {"paused", Type::INT},
+            {"turbo", Type::INT},
+            {"render_interval", Type::INT},
+            {"ntsc_filter", Type::INT},
+            {"upscaler", Type::INT},
+            {"upscale_time", Type::FLOAT},
+            {"sample_rate", Type::INT},
+            {"sample_format", Type::STRING},
+            {"audio_queue", Type::FLOAT},
+            {"audio_underruns", Type::INT},
+            {"audio_overruns", Type::INT},
+            {"rewind_interval", Type::INT},
+            {"rewind_snapshots", Type::INT},
+            {"run_ahead", Type::INT},
+            {"run_ahead_time", Type::FLOAT},
+            {"max_rollback", Type::INT},
+            {"rollback_depth", Type::INT},
+            {"resim_time", Type::FLOAT},
         };
         std::unordered_map<std::string, std::function<
                 bool(const void* const)>> constraints {
-            {"audio_buffer_min_size", [] (const void* const data) {
+            {"audio_latency", [] (const void* const data) {
                 return  
-                        *(reinterpret_cast<const int* const>(data)) >= 0
-                     && *(reinterpret_cast<const int* const>(data)) <= 0xFFFF;
+                        *(reinterpret_cast<const int* const>(data)) >= 1
+                     && *(reinterpret_cast<const int* const>(data)) <= 1000;
             }},
             {"frames_remaining", [] (const void* const data) {
                 return
@@ -120,11 +254,86 @@ class Nessdl {
                         *(reinterpret_cast<const int* const>(data)) == 0
                      || *(reinterpret_cast<const int* const>(data)) == 1;
             }},
+            {"turbo", [] (const void* const data) {
+                return 
+                        *(reinterpret_cast<const int* const>(data)) == 0
+                     || *(reinterpret_cast<const int* const>(data)) == 1;
+            }},
+            {"render_interval", [] (const void* const data) {
+                return 
+                        *(reinterpret_cast<const int* const>(data)) >= 1
+                     && *(reinterpret_cast<const int* const>(data)) <= 3600;
+            }},
+            {"rewind_interval", [] (const void* const data) {
+                return 
+                        *(reinterpret_cast<const int* const>(data)) >= 0
+                     && *(reinterpret_cast<const int* const>(data)) <= 3600;
+            }},
+            {"run_ahead", [] (const void* const data) {
+                return 
+                        *(reinterpret_cast<const int* const>(data)) >= 0
+                     && *(reinterpret_cast<const int* const>(data)) <= 8;
+            }},
+            {"max_rollback", [] (const void* const data) {
+                return 
+                        *(reinterpret_cast<const int* const>(data)) >= 1
+                     && *(reinterpret_cast<const int* const>(data)) <= 31;
+            }},
+            {"ntsc_filter", [] (const void* const data) {
+                return 
+                        *(reinterpret_cast<const int* const>(data)) == 0
+                     || *(reinterpret_cast<const int* const>(data)) == 1;
+            }},
+            {"upscaler", [] (const void* const data) {
+                return 
+                        *(reinterpret_cast<const int* const>(data)) >= 0
+                     && *(reinterpret_cast<const int* const>(data)) <= 4;
+            }},
+            {"sample_rate", [] (const void* const data) {
+                return 
+                        *(reinterpret_cast<const int* const>(data)) >= 8000
+                     && *(reinterpret_cast<const int* const>(data)) <= 192000;
+            }},
+            {"sample_format", [] (const void* const data) {
+                return 
+                        *(reinterpret_cast<const std::string* const>(data))
+                     == "s16"
+                     || *(reinterpret_cast<const std::string* const>(data))
+                     == "float";
+            }},
         };
         std::unordered_map<std::string, Field> fieldFromString {
-            {"audio_buffer_min_size", Field::AUDIO_BUFFER_MIN_SIZE},
+            {"audio_latency", Field::AUDIO_LATENCY},
             {"frames_remaining", Field::FRAMES_REMAINING},
             {"paused", Field::PAUSED},
+            {"turbo", Field::TURBO},
+            {"render_interval", Field::RENDER_INTERVAL},
+            {"ntsc_filter", Field::NTSC_FILTER},
+            {"upscaler", Field::UPSCALER},
+            {"upscale_time", Field::UPSCALE_TIME},
+            {"sample_rate", Field::SAMPLE_RATE},
+            {"sample_format", Field::SAMPLE_FORMAT},
+            {"audio_queue", Field::AUDIO_QUEUE},
+            {"audio_underruns", Field::AUDIO_UNDERRUNS},
+            {"audio_overruns", Field::AUDIO_OVERRUNS},
+            {"rewind_interval", Field::REWIND_INTERVAL},
+            {"rewind_snapshots", Field::REWIND_SNAPSHOTS},
+            {"run_ahead", Field::RUN_AHEAD},
+            {"run_ahead_time", Field::RUN_AHEAD_TIME},
+            {"max_rollback", Field::MAX_ROLLBACK},
+            {"rollback_depth", Field::ROLLBACK_DEPTH},
+            {"resim_time", Field::RESIM_TIME},
+        };
+        //Read-only fields measuring the emulator itself:
+        std::vector<std::string> statistics {
+            "upscale_time",
+            "audio_queue",
+            "audio_underruns",
+            "audio_overruns",
+            "rewind_snapshots",
+            "run_ahead_time",
+            "rollback_depth",
+            "resim_time",
         };
 
         std::unordered_map<std::string, std::function<
@@ -136,6 +345,7 @@ class Nessdl {
                      << "set <variable> <value>: changes the value of " 
                          << " a variable\n"
                      << "get <variable>: prints the value of a variable\n" 
+                     << "stats: prints the values of all statistics\n"
                      << "open <rom filename> <sram filename>: opens a ROM and" 
                          << " resets the system\n"
                      << "pause: pauses/unpauses the system\n"
@@ -154,6 +364,30 @@ class Nessdl {
                          << " state to a file\n"
                      << "loadstate <filename>: loads the current execution"
                          << " state from a file\n"
+                     << "quicksave <slot>: saves the current execution"
+                         << " state to an in-memory slot\n"
+                     << "quickload <slot>: loads the current execution"
+                         << " state from an in-memory slot\n"
+                     << "slots [count]: lists the in-memory slots in use, or"
+                         << " changes their number (emptying them)\n"
+                     << "(hold backspace to rewind, by rewind_interval"
+                         << " frames per step, or 0 to disable)\n"
+                     << "(set run_ahead to the number of frames of input lag"
+                         << " to hide, or 0 to disable)\n"
+                     << "capture <prefix/stop>: starts/stops recording each"
+                         << " audio channel and the mix to <prefix>-*.wav\n"
+                     << "hash [filename/stop]: prints the state hash, or"
+                         << " starts/stops logging it every frame\n"
+                     << "record <filename/stop>: starts/stops recording input"
+                         << " from the current state to a movie\n"
+                     << "play <filename/stop>: starts/stops playing a movie"
+                         << " (play power-on movies right after open)\n"
+                     << "netplay <player> <local port> <host:port>/stop:"
+                         << " starts/stops playing as player 1 or 2 against"
+                         << " another nessdl (both right after open), with"
+                         << " controller 1's buttons\n"
+                     << "(set max_rollback to the most frames to run ahead"
+                         << " of the other player's input)\n"
                      << "exit: quits nessdl\n"
                      << "> ";
             }},
@@ -162,6 +396,12 @@ class Nessdl {
                     std::cerr << "invalid field " << args[1] << "\n> ";
                     return;
                 }
+                if (
+                        std::find(statistics.begin(), statistics.end(), args[1])
+                     != statistics.end()) {
+                    std::cerr << args[1] << " is read-only\n> ";
+                    return;
+                }
                 if (fieldTypes[args[1]] == Type::INT) {
                     int value;
                     try {
@@ -217,6 +457,19 @@ class Nessdl {
                 }
                 std::cerr << "\n> ";
             }},
+            {"stats", [&] (std::vector<std::string>& args) {
+                for (auto& statistic : statistics) {
+                    std::cerr << statistic << ": ";
+                    if (fieldTypes[statistic] == Type::INT) {
+                        std::cerr << getField<int>(statistic.c_str());
+                    }
+                    else if (fieldTypes[statistic] == Type::FLOAT) {
+                        std::cerr << getField<float>(statistic.c_str());
+                    }
+                    std::cerr << "\n";
+                }
+                std::cerr << "> ";
+            }},
             {"open", [&] (std::vector<std::string>& args) {
                 RwWrapper rom {SDL_RWFromFile(args[1].c_str(), "rb")};
                 static RwWrapper sram {nullptr};
@@ -234,6 +487,8 @@ class Nessdl {
                 else {
                     nes.load(rom, sram);
                     nes.reset();
+                    stateSlots.prepare(nes);
+                    rewind.clear();
                 }
                 std::cerr << "> ";
             }},
@@ -243,6 +498,7 @@ class Nessdl {
             }},
             {"reset", [&] (std::vector<std::string>& args) {
                 nes.reset();
+                movieCommands |= Movie::resetCommand;
                 std::cerr << "> ";
             }},
             {"ramdump", [&] (std::vector<std::string>& args) {
@@ -362,10 +618,164 @@ class Nessdl {
                     std::cerr << "invalid filename " << args[1] << "\n> ";
                     return;
                 }
-                nes.loadState(state);
+                if (!nes.loadState(state)) {
+                    std::cerr << "invalid savestate " << args[1] << "\n";
+                }
+                std::cerr << "> ";
+            }},
+            {"quicksave", [&] (std::vector<std::string>& args) {
+                u16_fast slot;
+                try {
+                    slot = std::stoi(args[1], nullptr, 0);
+                }
+                catch (const std::invalid_argument& exception) {
+                    std::cerr << args[1] << " is not an integer\n> ";
+                    return;
+                }
+                if (!stateSlots.save(nes, slot)) {
+                    std::cerr << "invalid slot " << args[1] << "\n";
+                }
+                std::cerr << "> ";
+            }},
+            {"quickload", [&] (std::vector<std::string>& args) {
+                u16_fast slot;
+                try {
+                    slot = std::stoi(args[1], nullptr, 0);
+                }
+                catch (const std::invalid_argument& exception) {
+                    std::cerr << args[1] << " is not an integer\n> ";
+                    return;
+                }
+                if (!stateSlots.load(nes, slot)) {
+                    std::cerr << "slot " << args[1] << " is empty\n";
+                }
+                std::cerr << "> ";
+            }},
+            {"slots", [&] (std::vector<std::string>& args) {
+                if (args.size() > 1) {
+                    u16_fast count;
+                    try {
+                        count = std::stoi(args[1], nullptr, 0);
+                    }
+                    catch (const std::invalid_argument& exception) {
+                        std::cerr << args[1] << " is not an integer\n> ";
+                        return;
+                    }
+                    if (count < 1 || count > 1000) {
+                        std::cerr << "invalid slot count " << args[1] << "\n> ";
+                        return;
+                    }
+                    stateSlots.resize(nes, count);
+                }
+                std::cerr << stateSlots.count() << " slots, in use:";
+                for (u16_fast slot {0}; slot < stateSlots.count(); ++slot) {
+                    if (!stateSlots.isEmpty(slot)) {
+                        std::cerr << " " << slot;
+                    }
+                }
+                std::cerr << "\n> ";
+            }},
+            {"capture", [&] (std::vector<std::string>& args) {
+                audioCapture.reset();
+                if (args[1] != "stop") {
+                    audioCapture.reset(new AudioCapture {nes, args[1]});
+                    if (!audioCapture->isOpen()) {
+                        std::cerr << "cannot write to " << args[1] << "\n";
+                        audioCapture.reset();
+                    }
+                }
+                std::cerr << "> ";
+            }},
+            {"hash", [&] (std::vector<std::string>& args) {
+                if (args.size() < 2) {
+                    std::cerr 
+                            << std::hex << std::setfill('0') << std::setw(16)
+                            << nes.stateHash() << std::dec << "\n> ";
+                    return;
+                }
+                hashLog.reset();
+                if (args[1] != "stop") {
+                    hashLog.reset(new HashLog {args[1]});
+                    if (!hashLog->isOpen()) {
+                        std::cerr << "cannot write to " << args[1] << "\n";
+                        hashLog.reset();
+                    }
+                }
+                std::cerr << "> ";
+            }},
+            {"record", [&] (std::vector<std::string>& args) {
+                if (recordingMovie) {
+                    recordingMovie = false;
+                    if (!movie.save(movieFilename)) {
+                        std::cerr << "cannot write to " << movieFilename << "\n";
+                    }
+                }
+                if (args[1] != "stop") {
+                    playingMovie = false;
+                    recordingMovie = true;
+                    movieFilename = args[1];
+                    movieCommands = 0;
+                    movie.record(nes, false);
+                }
+                std::cerr << "> ";
+            }},
+            {"play", [&] (std::vector<std::string>& args) {
+                playingMovie = false;
+                if (args[1] != "stop") {
+                    if (recordingMovie) {
+                        std::cerr << "stop recording first\n> ";
+                        return;
+                    }
+                    if (!movie.load(args[1]) || !movie.start(nes)) {
+                        std::cerr << "invalid movie " << args[1] << "\n> ";
+                        return;
+                    }
+                    playingMovie = true;
+                    movieFrame = 0;
+                }
+                std::cerr << "> ";
+            }},
+            {"netplay", [&] (std::vector<std::string>& args) {
+                netplay.reset();
+                if (args[1] == "stop") {
+                    std::cerr << "> ";
+                    return;
+                }
+                const size_t colon {args.size() > 3 
+                      ? args[3].rfind(':') 
+                      : std::string::npos};
+                int player, localPort, peerPort;
+                try {
+                    if (colon == std::string::npos) {
+                        throw std::invalid_argument {"missing port"};
+                    }
+                    player = std::stoi(args[1]);
+                    localPort = std::stoi(args[2]);
+                    peerPort = std::stoi(args[3].substr(colon + 1));
+                }
+                catch (const std::invalid_argument& exception) {
+                    std::cerr << "invalid netplay parameters\n> ";
+                    return;
+                }
+                if (player < 1 || player > 2) {
+                    std::cerr << "invalid player " << args[1] << "\n> ";
+                    return;
+                }
+                netplay.reset(new Netplay {
+                        static_cast<u16>(localPort),
+                        args[3].substr(0, colon),
+                        static_cast<u16>(peerPort),
+                        static_cast<u8_fast>(player)});
+                if (!netplay->isOpen()) {
+                    std::cerr << "cannot open netplay socket\n";
+                    netplay.reset();
+                }
                 std::cerr << "> ";
             }},
             {"exit", [&] (std::vector<std::string>& args) {
+                if (recordingMovie && !movie.save(movieFilename)) {
+                    std::cerr << "cannot write to " << movieFilename << "\n";
+                }
                 getField<int>(Field::FRAMES_REMAINING) = 0;
             }},
         };
@@ -373,6 +783,7 @@ class Nessdl {
             {"help", 1},
             {"set", 3},
             {"get", 2},
+            {"stats", 1},
             {"open", 3},
             {"pause", 1},
             {"reset", 1},
@@ -381,6 +792,14 @@ class Nessdl {
             {"map", 3},
             {"write", 4},
             {"read", 3},
+            {"quicksave", 2},
+            {"quickload", 2},
+            {"slots", 1},
+            {"capture", 2},
+            {"hash", 1},
+            {"record", 2},
+            {"play", 2},
+            {"netplay", 2},
             {"exit", 1},
         };
         void runCommand(const std::string& command) { 
@@ -405,28 +824,59 @@ class Nessdl {
             }
         }
 
-    public:
+        //Runs on SDL's audio thread whenever the device needs samples:
+        static void audioCallback(
+                void* const userdata,
+                Uint8* const stream,
+                const int length) {
+            Nessdl& nessdl {*reinterpret_cast<Nessdl*>(userdata)};
+            const size_t read {nessdl.audioRing.read(stream, length)};
+            if (read < static_cast<size_t>(length)) {
+                //(zero bytes are silence in both s16 and float)
+                std::memset(stream + read, 0, length - read);
+                ++nessdl.audioUnderruns;
+            }
+        }
 
-        Nessdl() {
-            //Setup:
-            SDL_Init(SDL_INIT_AUDIO | SDL_INIT_VIDEO);
-            
-            SDL_AudioSpec desired, obtained;
+        //(Re)opens the audio device with the sample rate and format fields:
+        void openAudio() {
+            if (audioDevice) {
+                SDL_CloseAudioDevice(audioDevice);
+            }
+            audioRing.clear();
+            openedSampleRate = getField<int>(Field::SAMPLE_RATE);
+            openedSampleFormat = getField<std::string>(Field::SAMPLE_FORMAT);
+
+            SDL_AudioSpec desired;
             SDL_zero(desired);
-            desired.freq = 59562;
-            desired.format = AUDIO_U8;
+            desired.freq = openedSampleRate;
+            desired.format = 
+                    openedSampleFormat == "float" ? AUDIO_F32SYS : AUDIO_S16SYS;
             desired.channels = 1;
-            desired.samples = 2048;
-            desired.callback = nullptr;
+            desired.samples = 512;
+            desired.callback = audioCallback;
+            desired.userdata = this;
             audioDevice = SDL_OpenAudioDevice(
                     //default audio device:
                     nullptr, 
                     //is capture device:
                     0, 
                     &desired, 
-                    &obtained, 
-                    //prohibit changes to specification:
-                    0);
+                    &audioSpec, 
+                    //the device's own rate is resampled to directly:
+                    SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+            resampler.setRates(nes.audioSampleRate, audioSpec.freq);
+            //(devices open paused)
+            audioPlaying = false;
+        }
+
+    public:
+
+        Nessdl() {
+            //Setup:
+            SDL_Init(SDL_INIT_AUDIO | SDL_INIT_VIDEO);
+            
+            openAudio();
             window = SDL_CreateWindow(
                     "nessdl", 
                     SDL_WINDOWPOS_UNDEFINED,
@@ -444,23 +894,79 @@ class Nessdl {
                     SDL_TEXTUREACCESS_STREAMING,
                     256,
                     240);
+            for (u8_fast scale {2}; scale <= 3; ++scale) {
+                scaledTextures[scale] = SDL_CreateTexture(
+                        renderer, 
+                        SDL_PIXELFORMAT_ARGB8888,
+                        SDL_TEXTUREACCESS_STREAMING,
+                        256 * scale,
+                        240 * scale);
+            }
+            ntscTexture = SDL_CreateTexture(
+                    renderer, 
+                    SDL_PIXELFORMAT_ARGB8888,
+                    SDL_TEXTUREACCESS_STREAMING,
+                    768,
+                    240);
 
-            nes.audioOutputFunction = [&] (u8 sample) {
-                if (
-                        SDL_GetQueuedAudioSize(audioDevice) 
-                      < getField<int>(Field::AUDIO_BUFFER_MIN_SIZE)) {
-                    SDL_QueueAudio(
-                            audioDevice, 
-                            std::begin(emptyArray), 
-                            getField<int>(Field::AUDIO_BUFFER_MIN_SIZE));
-                }
-                SDL_QueueAudio(audioDevice, &sample, 1);
+            nes.audioOutputFunction = [&] (
+                    const s16* const samples,
+                    const u32_fast count) {
+                //Fast-forwarded audio would only pile up in the queue:
+                if (getField<int>(Field::TURBO)) {
+                    return;
+                }
+                const size_t sampleSize {
+                        audioSpec.format == AUDIO_F32SYS 
+                      ? sizeof(float) 
+                      : sizeof(s16)};
+                //Rather than play through a nearly empty queue, wait until
+                //there's enough audio to reach the target latency again:
+                if (audioPlaying && audioRing.size() == 0) {
+                    SDL_PauseAudioDevice(audioDevice, 1);
+                    audioPlaying = false;
+                }
+
+                const u8* data;
+                size_t size;
+                if (audioSpec.format == AUDIO_F32SYS) {
+                    floatAudioBuffer.clear();
+                    resampler.process(samples, count, floatAudioBuffer);
+                    data = reinterpret_cast<const u8*>(floatAudioBuffer.data());
+                    size = floatAudioBuffer.size() * sizeof(float);
+                }
+                else {
+                    audioBuffer.clear();
+                    resampler.process(samples, count, audioBuffer);
+                    data = reinterpret_cast<const u8*>(audioBuffer.data());
+                    size = audioBuffer.size() * sizeof(s16);
+                }
+                if (audioRing.write(data, size) < size) {
+                    ++getField<int>(Field::AUDIO_OVERRUNS);
+                }
+                getField<int>(Field::AUDIO_UNDERRUNS) = audioUnderruns;
+
+                const double queued {static_cast<double>(
+                        audioRing.size() / sampleSize)};
+                const double target {
+                        getField<int>(Field::AUDIO_LATENCY) 
+                      * audioSpec.freq / 1000.0};
+                getField<float>(Field::AUDIO_QUEUE) = 
+                        queued * 1000 / audioSpec.freq;
+                if (!audioPlaying && queued >= target) {
+                    SDL_PauseAudioDevice(audioDevice, 0);
+                    audioPlaying = true;
+                }
+                //Steer the queue towards the target by consuming emulated
+                //audio slightly faster or slower than real time:
+                resampler.adjust(1 + maxRateAdjustment * std::max(-1.0, std::min(
+                        1.0, 
+                        (queued - target) / target)));
             };
             nes.videoOutputFunction = [&] (u8_fast x, u8_fast y, u32 pixel) {
                 pixels[y * (pitch / sizeof(u32)) + x] = pixel;
             };
 
-            SDL_PauseAudioDevice(audioDevice, 0);
             SDL_DisableScreenSaver();
             std::cerr << "Nessdl CLI: type help for information\n> ";
 
@@ -498,6 +1004,9 @@ class Nessdl {
                                  == right.key.keysym.sym; 
                         };
                         pressed = event.key.state == SDL_PRESSED;
+                        if (event.key.keysym.sym == SDLK_BACKSPACE) {
+                            rewinding = pressed;
+                        }
                     break;
 
                     case SDL_CONTROLLERBUTTONDOWN:
@@ -517,32 +1026,174 @@ class Nessdl {
                     }
                     for (u8_fast i {0}; i < 8; ++i) {
                         if (match(event, buttonMap[i])) {
-                            setBit(nes.controller1, i, pressed); 
+                            setBit(pad1, i, pressed); 
                         }
                     }
                     for (u8_fast i {8}; i < 16; ++i) {
                         if (match(event, buttonMap[i])) {
-                            setBit(nes.controller2, i & 0x07, pressed); 
+                            setBit(pad2, i & 0x07, pressed); 
                         }
                     }
                 }
 
+                if (
+                        getField<int>(Field::SAMPLE_RATE) != openedSampleRate
+                     || getField<std::string>(Field::SAMPLE_FORMAT)
+                     != openedSampleFormat) {
+                    openAudio();
+                }
+
                 if (!getField<int>(Field::PAUSED)) {
-                    SDL_LockTexture(
-                            texture, 
-                            //region:
-                            nullptr, 
-                            reinterpret_cast<void**>(&pixels),  
-                            &pitch);
+                    nes.turbo = getField<int>(Field::TURBO);
+                    //While the rewind key is held, each frame goes back a
+                    //snapshot and shows the frame after it:
+                    rewind.interval = getField<int>(Field::REWIND_INTERVAL);
+                    //(netplay can't go back past what the other player saw)
+                    const bool steppingBack {
+                            rewinding && !netplay && rewind.stepBack(nes)};
+                    //Fast-forwarded and rewound audio is dropped anyway 
+                    //(unless it's being captured):
+                    nes.audioEnabled = 
+                            (!nes.turbo && !steppingBack) || audioCapture;
+                    nes.renderInterval = getField<int>(Field::RENDER_INTERVAL);
+                    const Upscaler::Mode upscalerMode {
+                            getField<int>(Field::NTSC_FILTER)
+                          ? Upscaler::Mode::NONE
+                          : static_cast<Upscaler::Mode>(
+                                    getField<int>(Field::UPSCALER))};
+
+                    if (upscalerMode != Upscaler::Mode::NONE) {
+                        pixels = frameBuffers[frameBuffer].data();
+                        pitch = 256 * sizeof(u32);
+                    }
+                    else {
+                        SDL_LockTexture(
+                                texture, 
+                                //region:
+                                nullptr, 
+                                reinterpret_cast<void**>(&pixels),  
+                                &pitch);
+                    }
+
+                    nes.controller1 = pad1;
+                    nes.controller2 = pad2;
+                    if (playingMovie && !steppingBack) {
+                        if (movieFrame < movie.frames.size()) {
+                            movie.playFrame(nes, movieFrame++);
+                        }
+                        else {
+                            playingMovie = false;
+                            std::cerr << "movie finished\n> ";
+                        }
+                    }
+                    else if (recordingMovie && !steppingBack) {
+                        movie.recordFrame(nes, movieCommands);
+                        movieCommands = 0;
+                    }
+
+                    //(false while netplay holds a frame back)
+                    bool ran {true};
+                    if (netplay) {
+                        //(frames are hashed as they run while logging, and
+                        //logged once confirmed)
+                        if (hashLog && !netplay->hashFrames) {
+                            netplayLoggedFrames = netplay->frame;
+                        }
+                        netplay->hashFrames = static_cast<bool>(hashLog);
+                        //(a frame the other player's input is too far
+                        //behind for is held back)
+                        netplay->maxRollback = 
+                                getField<int>(Field::MAX_ROLLBACK);
+                        ran = netplay->advance(nes, pad1);
+                        getField<int>(Field::ROLLBACK_DEPTH) = 
+                                netplay->rollbackDepth;
+                        getField<float>(Field::RESIM_TIME) = 
+                                netplay->resimTime;
+                    }
+                    else {
+                        //(shows the frame run_ahead frames from now)
+                        runAhead.frames = getField<int>(Field::RUN_AHEAD);
+                        runAhead.runFrame(nes);
+                        getField<float>(Field::RUN_AHEAD_TIME) = 
+                                runAhead.cost;
+                    }
+                    if (hashLog && netplay) {
+                        //(predicted frames may still be rolled back)
+                        while (
+                                netplayLoggedFrames 
+                              < netplay->confirmedFrames()) {
+                            u32_fast nesFrame;
+                            const u64 hash {netplay->frameHash(
+                                    netplayLoggedFrames, nesFrame)};
+                            hashLog->log(nesFrame, hash);
+                            ++netplayLoggedFrames;
+                        }
+                    }
+                    else if (hashLog) {
+                        hashLog->log(nes);
+                    }
+                    if (!steppingBack && ran) {
+                        rewind.capture(nes);
+                    }
+                    getField<int>(Field::REWIND_SNAPSHOTS) = 
+                            rewind.snapshotCount();
 
-                    for (u32_fast frame {nes.frame}; frame == nes.frame; ) {
-                        nes.tick();
+                    //Upscaled frames are shown a frame late, once the next
+                    //one has been emulated:
+                    if (upscaledTexture) {
+                        getField<float>(Field::UPSCALE_TIME) = upscaler.finish();
+                        SDL_UnlockTexture(upscaledTexture);
+                        //                                     src region  dst region
+                        SDL_RenderCopy(renderer, upscaledTexture, nullptr,   nullptr);
+                        SDL_RenderPresent(renderer);
+                        upscaledTexture = nullptr;
                     }
 
-                    SDL_UnlockTexture(texture);
-                    //                             src region  dst region
-                    SDL_RenderCopy(renderer, texture, nullptr,   nullptr);
-                    SDL_RenderPresent(renderer);
+                    //(a frame held back leaves nothing new to show)
+                    if (upscalerMode != Upscaler::Mode::NONE) {
+                        if (ran && !nes.frameSkipped) {
+                            upscaledTexture = scaledTextures[
+                                    Upscaler::scale(upscalerMode)];
+                            u32* upscaledPixels;
+                            int upscaledPitch;
+                            SDL_LockTexture(
+                                    upscaledTexture,
+                                    //region:
+                                    nullptr,
+                                    reinterpret_cast<void**>(&upscaledPixels),
+                                    &upscaledPitch);
+                            upscaler.start(
+                                    frameBuffers[frameBuffer].data(),
+                                    upscaledPixels,
+                                    upscaledPitch,
+                                    upscalerMode);
+                            frameBuffer ^= 1;
+                        }
+                    }
+                    else {
+                        SDL_UnlockTexture(texture);
+                        if (ran && !nes.frameSkipped) {
+                            SDL_Texture* frameTexture {texture};
+                            if (getField<int>(Field::NTSC_FILTER)) {
+                                SDL_LockTexture(
+                                        ntscTexture,
+                                        //region:
+                                        nullptr,
+                                        reinterpret_cast<void**>(&pixels),
+                                        &pitch);
+                                ntscFilter.apply(
+                                        nes.indexedFrame.data(),
+                                        pixels,
+                                        pitch,
+                                        nes.frame);
+                                SDL_UnlockTexture(ntscTexture);
+                                frameTexture = ntscTexture;
+                            }
+                            //                                  src region  dst region
+                            SDL_RenderCopy(renderer, frameTexture, nullptr,   nullptr);
+                            SDL_RenderPresent(renderer);
+                        }
+                    }
                 }
 
                 for (std::string line; asyncInput.get(line); ) {
@@ -550,7 +1201,10 @@ class Nessdl {
                 }
 
                 auto currentTime {std::chrono::steady_clock::now()};
-                if (currentTime < targetTime) {
+                if (getField<int>(Field::TURBO)) {
+                    targetTime = currentTime;
+                }
+                else if (currentTime < targetTime) {
                     std::this_thread::sleep_for(std::chrono::duration_cast<
                             std::chrono::nanoseconds>(
                                     targetTime - currentTime)); 
@@ -558,6 +1212,10 @@ class Nessdl {
             }
 
             //Cleanup:
+            if (upscaledTexture) {
+                upscaler.finish();
+                SDL_UnlockTexture(upscaledTexture);
+            }
             for (auto& field : fieldFromString) {
                 if (fieldTypes[field.first] == Type::INT) {
                     delete reinterpret_cast<int*>(
@@ -0,0 +1,349 @@
+#pragma once
+#include <cstring>
+#include <string>
+#include <vector>
+#include <array>
+#include <chrono>
+#include <algorithm>
+#ifdef OS_WINDOWS
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#include "byte.hpp"
+#include "nes-system.hpp"
+
+//Two player rollback netplay over UDP. Each side runs every frame as
+//soon as its own input is known, predicting that the other player's
+//buttons haven't changed since the last input received from them, and
+//saves the state each frame starts from. When the real input turns out
+//to differ, the state of the first mispredicted frame is loaded and the
+//frames since are run again, unseen and unheard, within the same host
+//frame. Both sides have to start from the same state (e.g. right after
+//loading the same ROM). Packets (little endian):
+//  magic    4 bytes  "NNET"
+//  ack      4 bytes  number of frames of input received from the peer
+//  start    4 bytes  frame of the first input
+//  count    1 byte
+//  inputs   count bytes, the sender's controller for frames start on
+//Every packet repeats all the input the peer hasn't acknowledged, so
+//lost packets only cost time.
+class Netplay {
+    private:
+        static constexpr u32 magic {0x54454E4E};
+        static constexpr size_t headerSize {13};
+        //Frames of state and input kept (covers maxRollback frames behind
+        //and ahead):
+        static constexpr u32 ringSize {64};
+
+#ifdef OS_WINDOWS
+        using Socket = SOCKET;
+        static constexpr Socket noSocket {INVALID_SOCKET};
+#else
+        using Socket = int;
+        static constexpr Socket noSocket {-1};
+#endif
+        Socket socket {noSocket};
+        sockaddr_in peer {};
+        //Player 1 or 2:
+        u8_fast player {1};
+
+        std::array<std::vector<u8>, ringSize> states;
+        std::array<size_t, ringSize> stateSizes {};
+        //By frame % ringSize:
+        std::array<u8, ringSize> localInputs {};
+        std::array<u8, ringSize> remoteInputs {};
+        //The remote input each frame last ran with:
+        std::array<u8, ringSize> usedInputs {};
+        //The state hash and frame count after each frame last ran (with
+        //hashFrames):
+        std::array<u64, ringSize> hashes {};
+        std::array<u32_fast, ringSize> nesFrames {};
+
+        //Frames of the peer's input received (in order):
+        u32 remoteCount {0};
+        //Frames of local input the peer has received:
+        u32 remoteAck {0};
+        //First frame that ran with the wrong remote input, if any:
+        u32 rollbackFrom {0};
+        bool mispredicted {false};
+
+        std::vector<u8> packet;
+
+        u8 predictedInput(const u32 index) const {
+            if (index < remoteCount) {
+                return remoteInputs[index % ringSize];
+            }
+            return remoteCount 
+                  ? remoteInputs[(remoteCount - 1) % ringSize] 
+                  : 0;
+        }
+
+        void runFrame(Nes& nes, const u32 index, const bool shown) {
+            //(the state each frame starts from, for rolling back to)
+            std::vector<u8>& state {states[index % ringSize]};
+            size_t& size {stateSizes[index % ringSize]};
+            size = nes.saveToBuffer(state.data(), state.size());
+            if (size > state.size()) {
+                state.resize(size);
+                nes.saveToBuffer(state.data(), size);
+            }
+
+            const u8 local {localInputs[index % ringSize]};
+            const u8 remote {predictedInput(index)};
+            usedInputs[index % ringSize] = remote;
+            nes.controller1 = player == 1 ? local : remote;
+            nes.controller2 = player == 1 ? remote : local;
+            if (!shown) {
+                nes.skipFrame();
+            }
+            for (const u32_fast nesFrame {nes.frame}; nesFrame == nes.frame; ) {
+                nes.tick();
+            }
+            nes.flushAudio();
+            if (hashFrames) {
+                hashes[index % ringSize] = nes.stateHash();
+                nesFrames[index % ringSize] = nes.frame;
+            }
+        }
+
+        //Loads the state of the first mispredicted frame and runs the
+        //frames since again, silently:
+        void rollBack(Nes& nes) {
+            const auto startTime {std::chrono::steady_clock::now()};
+            nes.loadFromBuffer(
+                    states[rollbackFrom % ringSize].data(),
+                    stateSizes[rollbackFrom % ringSize]);
+            const bool audioEnabled {nes.audioEnabled};
+            nes.audioEnabled = false;
+            for (u32 index {rollbackFrom}; index < frame; ++index) {
+                runFrame(nes, index, false);
+            }
+            nes.audioEnabled = audioEnabled;
+            mispredicted = false;
+
+            ++rollbacks;
+            rollbackDepth = frame - rollbackFrom;
+            maxRollbackDepth = std::max(maxRollbackDepth, rollbackDepth);
+            const std::chrono::duration<double, std::milli> elapsed {
+                    std::chrono::steady_clock::now() - startTime};
+            resimTime = elapsed.count();
+        }
+
+        void send() {
+            const u32 start {remoteAck};
+            const u8_fast count {
+                    static_cast<u8_fast>(std::min<u32>(frame - start, 255))};
+            packet.resize(headerSize + count);
+            writeBytes<4>(&packet[0], magic);
+            writeBytes<4>(&packet[4], remoteCount);
+            writeBytes<4>(&packet[8], start);
+            packet[12] = count;
+            for (u8_fast i {0}; i < count; ++i) {
+                packet[headerSize + i] = localInputs[(start + i) % ringSize];
+            }
+            sendto(
+                    socket,
+                    reinterpret_cast<const char*>(packet.data()),
+                    packet.size(),
+                    0,
+                    reinterpret_cast<const sockaddr*>(&peer),
+                    sizeof(peer));
+        }
+
+        void receive() {
+            u8 data[headerSize + 255];
+            for (
+                    long size;
+                    (size = recv(
+                            socket, 
+                            reinterpret_cast<char*>(data), 
+                            sizeof(data), 
+                            0)) > 0; ) {
+                if (
+                        static_cast<size_t>(size) < headerSize
+                     || readBytes<4, u32>(&data[0]) != magic
+                     || static_cast<size_t>(size) < headerSize + data[12]) {
+                    continue;
+                }
+                remoteAck = std::min(
+                        frame,
+                        std::max(remoteAck, readBytes<4, u32>(&data[4])));
+                const u32 start {readBytes<4, u32>(&data[8])};
+                const u8_fast count {data[12]};
+                //(the peer can't be more than maxRollback frames ahead)
+                for (
+                        u32 index {remoteCount};
+                        index >= start
+                     && index < start + count
+                     && index < frame + ringSize / 2;
+                        index = ++remoteCount) {
+                    const u8 input {data[headerSize + index - start]};
+                    remoteInputs[index % ringSize] = input;
+                    if (
+                            index < frame
+                         && input != usedInputs[index % ringSize]
+                         && (!mispredicted || index < rollbackFrom)) {
+                        rollbackFrom = index;
+                        mispredicted = true;
+                    }
+                }
+            }
+        }
+
+    public:
+        //Most frames run ahead of the peer's input (at most ringSize / 2 -
+        //1), beyond which frames are held back until it arrives:
+        u8_fast maxRollback {8};
+        //Frames run so far:
+        u32 frame {0};
+        //Rollbacks so far, frames rerun by the last (0 if the last call
+        //didn't roll back) and the most in any, and how long the last took
+        //(in milliseconds):
+        u32 rollbacks {0};
+        u32 rollbackDepth {0};
+        u32 maxRollbackDepth {0};
+        double resimTime {0};
+        //Host frames spent waiting for the peer:
+        u32 stalls {0};
+        //Whether to hash the state after each frame, for frameHash:
+        bool hashFrames {false};
+
+        //Listens on localPort and sends to peerHost:peerPort, as player 1
+        //or 2:
+        Netplay(
+                const u16 localPort,
+                const std::string& peerHost,
+                const u16 peerPort,
+                const u8_fast player)
+              : player{player} {
+#ifdef OS_WINDOWS
+            WSADATA data;
+            if (WSAStartup(MAKEWORD(2, 2), &data)) {
+                return;
+            }
+#endif
+            addrinfo hints {};
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_DGRAM;
+            addrinfo* address;
+            if (getaddrinfo(peerHost.c_str(), nullptr, &hints, &address)) {
+                return;
+            }
+            peer = *reinterpret_cast<sockaddr_in*>(address->ai_addr);
+            peer.sin_port = htons(peerPort);
+            freeaddrinfo(address);
+
+            socket = ::socket(AF_INET, SOCK_DGRAM, 0);
+#ifdef OS_WINDOWS
+            u_long nonBlocking {1};
+            const bool blocking {
+                    ioctlsocket(socket, FIONBIO, &nonBlocking) != 0};
+#else
+            const bool blocking {fcntl(socket, F_SETFL, O_NONBLOCK) != 0};
+#endif
+            sockaddr_in local {};
+            local.sin_family = AF_INET;
+            local.sin_addr.s_addr = htonl(INADDR_ANY);
+            local.sin_port = htons(localPort);
+            if (
+                    socket == noSocket
+                 || bind(
+                            socket,
+                            reinterpret_cast<const sockaddr*>(&local),
+                            sizeof(local))
+                 || blocking) {
+                close();
+            }
+        }
+        Netplay(const Netplay&) = delete;
+        Netplay& operator= (const Netplay&) = delete;
+        ~Netplay() {
+            close();
+#ifdef OS_WINDOWS
+            WSACleanup();
+#endif
+        }
+
+        bool isOpen() const {
+            return socket != noSocket;
+        }
+        void close() {
+            if (socket != noSocket) {
+#ifdef OS_WINDOWS
+                closesocket(socket);
+#else
+                ::close(socket);
+#endif
+                socket = noSocket;
+            }
+        }
+
+        //Runs a frame with the local player's input, unless the peer has
+        //fallen maxRollback frames behind, in which case it returns false
+        //and the host frame should be spent waiting. Audio is flushed:
+        bool advance(Nes& nes, const u8 input) {
+            receive();
+            rollbackDepth = 0;
+            resimTime = 0;
+            if (mispredicted) {
+                rollBack(nes);
+            }
+            const u32 lead {std::min<u32>(maxRollback, ringSize / 2 - 1)};
+            if (frame >= remoteCount + lead) {
+                ++stalls;
+                send();
+                return false;
+            }
+
+            localInputs[frame % ringSize] = input;
+            runFrame(nes, frame, true);
+            ++frame;
+            send();
+            return true;
+        }
+
+        //Corrects any misprediction, returning whether every frame run so
+        //far has the peer's real input and the peer has all of ours (to
+        //end a session on the same state as the peer):
+        bool settle(Nes& nes) {
+            receive();
+            rollbackDepth = 0;
+            resimTime = 0;
+            if (mispredicted) {
+                rollBack(nes);
+            }
+            send();
+            return remoteCount >= frame && remoteAck >= frame;
+        }
+
+        //Frames run with both players' real input, which no rollback
+        //will change (after advance or settle):
+        u32 confirmedFrames() const {
+            return std::min(remoteCount, frame);
+        }
+        //The state hash (see Nes::stateHash) and Nes::frame after a
+        //confirmed frame, with hashFrames (only kept for a few dozen
+        //frames, so read them after every advance):
+        u64 frameHash(const u32 index, u32_fast& nesFrame) const {
+            nesFrame = nesFrames[index % ringSize];
+            return hashes[index % ringSize];
+        }
+
+        //Waits up to milliseconds for a packet:
+        void wait(const int milliseconds) {
+            pollfd descriptor {socket, POLLIN, 0};
+#ifdef OS_WINDOWS
+            WSAPoll(&descriptor, 1, milliseconds);
+#else
+            poll(&descriptor, 1, milliseconds);
+#endif
+        }
+};
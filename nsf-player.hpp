@@ -0,0 +1,85 @@
+#pragma once
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include "byte.hpp"
+#include "ines.hpp"
+#include "nes-system.hpp"
+#include "file-wrapper.hpp"
+#include "wav-writer.hpp"
+#include "worker-pool.hpp"
+
+//Renders the songs of an NSF to WAV files as fast as possible, each on
+//its own emulated system with video disabled, several songs at once:
+class NsfPlayer {
+    private:
+        WorkerPool workers;
+
+        void renderSong(
+                const std::string& filename,
+                const u8_fast song,
+                const std::string& outputFilename,
+                const double seconds) {
+            FileWrapper rom {std::fopen(filename.c_str(), "rb")};
+            if (!rom.data) {
+                return;
+            }
+            std::unique_ptr<Nes> nes {new Nes};
+            nes->loadNsf(rom, song);
+            nes->reset();
+            nes->turbo = true;
+            nes->renderInterval = 0;
+
+            WavWriter writer {{outputFilename}, static_cast<u32>(
+                    std::lround(nes->audioSampleRate))};
+            nes->audioOutputFunction = [&] (
+                    const s16* const samples,
+                    const u32_fast count) {
+                writer.write(0, samples, count);
+            };
+
+            //(at 60.0988 frames per second)
+            const u32_fast frames = seconds * 60.0988;
+            for (u32_fast i {0}; i < frames; ++i) {
+                for (u32_fast frame {nes->frame}; frame == nes->frame; ) {
+                    nes->tick();
+                }
+                nes->flushAudio();
+            }
+        }
+
+    public:
+        NsfPlayer(const u8_fast workerCount = WorkerPool::defaultWorkerCount())
+              : workers{workerCount} {
+        }
+
+        //Renders songs first to last (0-based) for the given length each,
+        //to prefix-<song>.wav (numbered from 1 like NSF players do), and
+        //returns the filenames:
+        std::vector<std::string> render(
+                const std::string& filename,
+                const std::string& prefix,
+                const u8_fast first,
+                const u8_fast last,
+                const double seconds) {
+            std::vector<std::string> outputFilenames;
+            for (u16_fast song {first}; song <= last; ++song) {
+                outputFilenames.push_back(
+                        prefix + "-" + std::to_string(song + 1) + ".wav");
+            }
+            //(one song per work item, so the threads split the songs)
+            workers.run(outputFilenames.size(), [&] (
+                    const u32_fast firstItem,
+                    const u32_fast lastItem) {
+                for (u32_fast item {firstItem}; item < lastItem; ++item) {
+                    renderSong(
+                            filename,
+                            first + item,
+                            outputFilenames[item],
+                            seconds);
+                }
+            });
+            return outputFilenames;
+        }
+};
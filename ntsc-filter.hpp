@@ -0,0 +1,208 @@
+#pragma once
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define NTSC_FILTER_SSE2
+#endif
+#include "byte.hpp"
+#include "worker-pool.hpp"
+
+//Composite NTSC video filter. Turns the PPU's indexed framebuffer
+//(palette index | emphasis << 6 per pixel) into 768x240 ARGB by
+//synthesizing the PPU's composite signal (8 samples per pixel, 12 per
+//color cycle) and decoding it back through YIQ.
+//Decoding is linear, so each pixel's effect on nearby output pixels is
+//precomputed per palette entry and color phase, and filtering a line is
+//a sum of table lookups. Lines are left for the renderer to stretch to
+//the 4:3 height rather than copied.
+class NtscFilter {
+    private:
+        WorkerPool& workers;
+
+        //Decoder adjustments, fitted so that flat colors match
+        //Ppu::palette:
+        const double hue {4.0};
+        const double saturation {0.6};
+
+        //A pixel's signal reaches this many pixels to either side once
+        //chroma is filtered:
+        static constexpr u8_fast reach {2};
+        static constexpr u8_fast kernelCount {reach * 2 + 1};
+        //Fixed point fraction bits of the kernels:
+        static constexpr u8_fast precision {5};
+
+        //Contribution of a pixel (per palette entry, color phase and
+        //distance) to the 3 output pixels of a neighbour, as B, G, R, A
+        //lanes (the last 4 lanes are padding):
+        std::vector<std::array<s16, 16>> kernels;
+
+        static bool inColorPhase(const u8_fast color, const u8_fast phase) {
+            return (color + phase) % 12 < 6;
+        }
+
+        //Normalized composite level of one signal sample:
+        static double sample(const u16_fast entry, const u8_fast phase) {
+            const std::array<double, 4> lows {0.228, 0.312, 0.552, 0.880};
+            const std::array<double, 4> highs {0.616, 0.840, 1.100, 1.100};
+            const double black {0.312}, white {1.100};
+            const double attenuation {0.746};
+
+            const u8_fast color = entry & 0x0F;
+            const u8_fast level = color > 0x0D ? 1 : entry >> 4 & 0x03;
+            const u8_fast emphasis = entry >> 6;
+            double low {lows[level]};
+            double high {highs[level]};
+            if (color == 0x00) {
+                low = high;
+            }
+            else if (color > 0x0C) {
+                high = low;
+            }
+
+            double value {inColorPhase(color, phase) ? high : low};
+            if (
+                    (emphasis & 0x01 && inColorPhase(0x0C, phase))
+                 || (emphasis & 0x02 && inColorPhase(0x04, phase))
+                 || (emphasis & 0x04 && inColorPhase(0x08, phase))) {
+                value *= attenuation;
+            }
+            return (value - black) / (white - black);
+        }
+
+        void buildKernels() {
+            const double pi {3.14159265358979323846};
+            for (u16_fast entry {0}; entry < 512; ++entry) {
+                for (u8_fast phaseClass {0}; phaseClass < 3; ++phaseClass) {
+                    for (u8_fast distance {0}; distance < kernelCount; ++distance) {
+                        std::array<s16, 16>& kernel {kernels[
+                                (entry * 3 + phaseClass) * kernelCount
+                              + distance]};
+                        kernel.fill(0);
+                        for (u8_fast output {0}; output < 3; ++output) {
+                            //Output pixel center in samples from the start
+                            //of the pixel being filtered:
+                            const double center {(output + 0.5) * 8 / 3};
+                            double chromaTotal {0};
+                            for (s16_fast s {-24}; s < 32; ++s) {
+                                chromaTotal += std::max(
+                                        0.0,
+                                        1 - std::fabs(s + 0.5 - center) / 12);
+                            }
+
+                            double y {0}, i {0}, q {0};
+                            for (u8_fast n {0}; n < 8; ++n) {
+                                const u8_fast phase = (phaseClass * 4 + n) % 12;
+                                const double value {sample(entry, phase)};
+                                const double offset {std::fabs(
+                                        (distance - reach) * 8.0
+                                      + n + 0.5 - center)};
+                                //Luma: box over one color cycle:
+                                if (offset < 6) {
+                                    y += value / 12;
+                                }
+                                //Chroma: triangle over two color cycles:
+                                const double weight {std::max(
+                                        0.0,
+                                        1 - offset / 12) / chromaTotal};
+                                const double angle {2 * pi * (phase + hue) / 12};
+                                i += 2 * value * weight * std::cos(angle);
+                                q += 2 * value * weight * std::sin(angle);
+                            }
+                            i *= saturation;
+                            q *= saturation;
+
+                            const std::array<double, 3> bgr {
+                                    y - 1.106 * i + 1.703 * q,
+                                    y - 0.272 * i - 0.647 * q,
+                                    y + 0.956 * i + 0.621 * q};
+                            for (u8_fast channel {0}; channel < 3; ++channel) {
+                                kernel[output * 4 + channel] = std::lround(
+                                        bgr[channel] * 255 * (1 << precision));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        void filterLine(
+                const u16* const input,
+                const u16_fast y,
+                const u8_fast frameClass,
+                u32* const output) const {
+            //Kernel offsets per pixel, padded with black on both ends:
+            std::array<u32_fast, 256 + reach * 2> bases;
+            for (s16_fast x {-reach}; x < 256 + reach; ++x) {
+                const u16_fast entry = x >= 0 && x < 256 ? input[x] : 0x0F;
+                //8 samples per pixel advance the color phase by 2/3 cycle:
+                const u8_fast phaseClass = (2 * (x + 3) + y + frameClass) % 3;
+                bases[x + reach] = (entry * 3 + phaseClass) * kernelCount;
+            }
+
+            for (u16_fast x {0}; x < 256; ++x) {
+                #ifdef NTSC_FILTER_SSE2
+                    __m128i low {_mm_setzero_si128()};
+                    __m128i high {_mm_setzero_si128()};
+                    for (u8_fast distance {0}; distance < kernelCount; ++distance) {
+                        const s16* const kernel {kernels[
+                                bases[x + distance] + distance].data()};
+                        low = _mm_adds_epi16(low, _mm_loadu_si128(
+                                reinterpret_cast<const __m128i*>(kernel)));
+                        high = _mm_adds_epi16(high, _mm_loadu_si128(
+                                reinterpret_cast<const __m128i*>(kernel + 8)));
+                    }
+                    low = _mm_srai_epi16(low, precision);
+                    high = _mm_srai_epi16(high, precision);
+                    const __m128i pixels {_mm_packus_epi16(low, high)};
+                    std::memcpy(output + x * 3, &pixels, 12);
+                #else
+                    std::array<s32_fast, 12> sums {};
+                    for (u8_fast distance {0}; distance < kernelCount; ++distance) {
+                        const s16* const kernel {kernels[
+                                bases[x + distance] + distance].data()};
+                        for (u8_fast lane {0}; lane < 12; ++lane) {
+                            sums[lane] += kernel[lane];
+                        }
+                    }
+                    for (u8_fast pixel {0}; pixel < 3; ++pixel) {
+                        u32 color {0};
+                        for (u8_fast channel {0}; channel < 3; ++channel) {
+                            const s32_fast value {
+                                    sums[pixel * 4 + channel] >> precision};
+                            color |= (value < 0 ? 0 : value > 255 ? 255 : value)
+                                  << (channel * 8);
+                        }
+                        output[x * 3 + pixel] = color;
+                    }
+                #endif
+            }
+        }
+
+    public:
+        NtscFilter(WorkerPool& workers)
+              : workers{workers}, kernels(512 * 3 * kernelCount) {
+            buildKernels();
+        }
+
+        //Filters a 256x240 indexed frame into 768x240 pixels (pitch in
+        //bytes, as SDL_LockTexture reports it):
+        void apply(
+                const u16* const input,
+                u32* const output,
+                const int pitch,
+                const u32_fast frame) {
+            //Odd frames are a dot shorter, shifting the color phase:
+            const u8_fast frameClass = frame & 1;
+            workers.run(240, [&] (u32_fast first, u32_fast last) {
+                for (u32_fast y {first}; y < last; ++y) {
+                    u32* const line {reinterpret_cast<u32*>(
+                            reinterpret_cast<u8*>(output) + y * pitch)};
+                    filterLine(input + y * 256, y, frameClass, line);
+                }
+            });
+        }
+};
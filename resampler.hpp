@@ -0,0 +1,133 @@
+#pragma once
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#if defined(__SSE__) || defined(_M_X64)
+    #include <xmmintrin.h>
+    #define RESAMPLER_SSE
+#endif
+#include "byte.hpp"
+
+//Polyphase windowed sinc resampler for blocks of mono s16 samples. The
+//filter for an output sample is interpolated between the 2 nearest of
+//phaseCount precomputed sub-sample phases.
+class Resampler {
+    private:
+        static constexpr u8_fast tapCount {32};
+        static constexpr u16_fast phaseCount {256};
+
+        //Taps per phase (plus one phase past the last for interpolation):
+        std::vector<float> kernels;
+        //Input samples still needed by later output samples:
+        std::vector<float> history;
+        //Input samples per output sample, as set and as adjusted:
+        double baseStep {1};
+        double step {1};
+        //Position of the next output sample in history:
+        double position {0};
+
+        void buildKernels(const double cutoff) {
+            const double pi {3.14159265358979323846};
+            kernels.resize((phaseCount + 1) * tapCount);
+            for (u16_fast phase {0}; phase <= phaseCount; ++phase) {
+                float* const kernel {kernels.data() + phase * tapCount};
+                double sum {0};
+                for (u8_fast tap {0}; tap < tapCount; ++tap) {
+                    const double t {
+                            tap - (tapCount / 2 - 1.0)
+                          - static_cast<double>(phase) / phaseCount};
+                    const double x {2 * pi * cutoff * t};
+                    const double sinc {x == 0 ? 1 : std::sin(x) / x};
+                    //Blackman window:
+                    const double w {pi * (t / (tapCount / 2) + 1)};
+                    kernel[tap] = sinc * (
+                            0.42 - 0.5 * std::cos(w) + 0.08 * std::cos(2 * w));
+                    sum += kernel[tap];
+                }
+                for (u8_fast tap {0}; tap < tapCount; ++tap) {
+                    kernel[tap] /= sum;
+                }
+            }
+        }
+
+        float convolve(const float* const input, const float* const kernel) const {
+            #ifdef RESAMPLER_SSE
+                __m128 sums {_mm_setzero_ps()};
+                for (u8_fast tap {0}; tap < tapCount; tap += 4) {
+                    sums = _mm_add_ps(sums, _mm_mul_ps(
+                            _mm_loadu_ps(input + tap),
+                            _mm_loadu_ps(kernel + tap)));
+                }
+                sums = _mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+                sums = _mm_add_ss(sums, _mm_shuffle_ps(sums, sums, 1));
+                return _mm_cvtss_f32(sums);
+            #else
+                float sum {0};
+                for (u8_fast tap {0}; tap < tapCount; ++tap) {
+                    sum += input[tap] * kernel[tap];
+                }
+                return sum;
+            #endif
+        }
+
+        static void convert(const float sample, float& output) {
+            output = sample;
+        }
+        static void convert(const float sample, s16& output) {
+            output = std::lround(std::max(-1.0f, std::min(sample, 32767 / 32768.0f))
+                  * 32768);
+        }
+
+    public:
+        Resampler(const double inputRate = 1, const double outputRate = 1) {
+            setRates(inputRate, outputRate);
+        }
+
+        void setRates(const double inputRate, const double outputRate) {
+            baseStep = step = inputRate / outputRate;
+            //Keep below the lower of the 2 Nyquist frequencies (in cycles
+            //per input sample):
+            buildKernels(0.45 * std::min(1.0, outputRate / inputRate));
+            history.assign(tapCount, 0);
+            position = 0;
+        }
+
+        //Scales the input consumed per output sample (for rate control,
+        //factors a little above 1 produce slightly fewer samples):
+        void adjust(const double factor) {
+            step = baseStep * factor;
+        }
+
+        //Resamples a block of input, appending to output (float samples
+        //are from -1 to 1):
+        template <typename SampleType>
+        void process(
+                const s16* const input,
+                const u32_fast count,
+                std::vector<SampleType>& output) {
+            const size_t kept {history.size()};
+            history.resize(kept + count);
+            for (u32_fast i {0}; i < count; ++i) {
+                history[kept + i] = input[i] / 32768.0f;
+            }
+
+            for (; position + tapCount < history.size(); position += step) {
+                const u32_fast index = position;
+                const double phase {(position - index) * phaseCount};
+                const u16_fast lower = phase;
+                const float fraction = phase - lower;
+                const float* const kernel {kernels.data() + lower * tapCount};
+                const float near {convolve(history.data() + index, kernel)};
+                const float far {convolve(
+                        history.data() + index,
+                        kernel + tapCount)};
+                SampleType sample;
+                convert(near + (far - near) * fraction, sample);
+                output.push_back(sample);
+            }
+
+            const u32_fast consumed = position;
+            history.erase(history.begin(), history.begin() + consumed);
+            position -= consumed;
+        }
+};
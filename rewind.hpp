@@ -0,0 +1,244 @@
+#pragma once
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <deque>
+#include "byte.hpp"
+#include "lz.hpp"
+#include "nes-system.hpp"
+
+//Savestates taken every few frames, kept in a fixed-size arena for
+//stepping backwards. Every keyframeInterval-th snapshot is a keyframe and
+//the rest are deltas against it: the XOR of the two states, which is
+//mostly zeros. Both are stored compressed (see lz.hpp). Once the arena is
+//full, the oldest keyframe and its deltas make room.
+class Rewind {
+    private:
+        struct Entry {
+            u32_fast id;
+            //Id of the keyframe a delta is against (its own if a keyframe):
+            u32_fast keyId;
+            //Snapshots since the keyframe (0 for a keyframe):
+            u16_fast deltaIndex;
+            size_t offset;
+            size_t size;
+        };
+
+        const size_t arenaSize;
+        const u16_fast keyframeInterval;
+        //(allocated by the first snapshot, without touching its pages)
+        std::unique_ptr<u8[]> arena;
+        //Oldest first, with consecutive ids:
+        std::deque<Entry> entries;
+        //Bytes of the arena in use:
+        size_t used {0};
+        u32_fast nextId {0};
+        u32_fast framesSinceSnapshot {0};
+
+        size_t stateSize {0};
+        std::vector<u8> state;
+        std::vector<u8> delta;
+        std::vector<u8> encoded;
+        //A decoded keyframe, kept for the deltas against it:
+        std::vector<u8> keyState;
+        u32_fast keyStateId {~static_cast<u32_fast>(0)};
+
+        //Compresses the XOR of state and reference (zeros if nullptr) into
+        //encoded and returns the compressed size:
+        size_t encode(const u8* const reference) {
+            const u8* source {state.data()};
+            if (reference) {
+                for (size_t i {0}; i < stateSize; ++i) {
+                    delta[i] = state[i] ^ reference[i];
+                }
+                source = delta.data();
+            }
+            return lz::compress(source, stateSize, encoded.data());
+        }
+        //Decompresses a snapshot into out, returning false if it's
+        //damaged:
+        bool decode(
+                const u8* const in,
+                const size_t size,
+                const u8* const reference,
+                u8* const out) {
+            if (!lz::decompress(in, size, out, stateSize)) {
+                return false;
+            }
+            if (reference) {
+                for (size_t i {0}; i < stateSize; ++i) {
+                    out[i] ^= reference[i];
+                }
+            }
+            return true;
+        }
+
+        const Entry& entry(const u32_fast id) const {
+            return entries[id - entries.front().id];
+        }
+        //Decodes a keyframe into keyState unless it's already there
+        //(nullptr if it's damaged):
+        const u8* keyframe(const u32_fast id) {
+            if (keyStateId != id) {
+                const Entry& key {entry(id)};
+                keyStateId = ~static_cast<u32_fast>(0);
+                if (!decode(
+                        arena.get() + key.offset, key.size, nullptr,
+                        keyState.data())) {
+                    return nullptr;
+                }
+                keyStateId = id;
+            }
+            return keyState.data();
+        }
+
+        void dropOldest() {
+            used -= entries.front().size;
+            entries.pop_front();
+        }
+        //Frees [offset, offset + size) by dropping the oldest snapshots,
+        //never leaving deltas without their keyframe:
+        void evict(const size_t offset, const size_t size) {
+            while (
+                    !entries.empty()
+                 && entries.front().offset < offset + size
+                 && entries.front().offset + entries.front().size > offset) {
+                dropOldest();
+                while (!entries.empty() && entries.front().deltaIndex) {
+                    dropOldest();
+                }
+            }
+        }
+
+        void store() {
+            bool isKeyframe {
+                    entries.empty()
+                 || entries.back().deltaIndex + 1 >= keyframeInterval};
+            while (true) {
+                const u32_fast keyId {
+                        isKeyframe ? nextId : entries.back().keyId};
+                const u8* const reference {
+                        isKeyframe ? nullptr : keyframe(keyId)};
+                if (!isKeyframe && !reference) {
+                    //(its keyframe is damaged, so this one starts over)
+                    isKeyframe = true;
+                    continue;
+                }
+                const size_t size {encode(reference)};
+                if (size > arenaSize) {
+                    return;
+                }
+
+                const u16_fast deltaIndex =
+                        isKeyframe ? 0 : entries.back().deltaIndex + 1;
+                //Written after the newest snapshot, wrapping around to the
+                //start of the arena if it doesn't fit before the end:
+                size_t offset {entries.empty()
+                      ? 0
+                      : entries.back().offset + entries.back().size};
+                if (offset + size > arenaSize) {
+                    //(whatever is left past the newest snapshot is older
+                    //than anything at the start, so it goes first)
+                    evict(offset, arenaSize - offset);
+                    offset = 0;
+                }
+                evict(offset, size);
+                if (
+                        !isKeyframe
+                     && (entries.empty() || entries.front().id > keyId)) {
+                    //(its keyframe was just dropped)
+                    isKeyframe = true;
+                    continue;
+                }
+
+                std::memcpy(arena.get() + offset, encoded.data(), size);
+                entries.push_back(Entry {
+                        nextId, keyId, deltaIndex, offset, size});
+                used += size;
+                if (isKeyframe) {
+                    keyState = state;
+                    keyStateId = nextId;
+                }
+                ++nextId;
+                return;
+            }
+        }
+
+    public:
+        Rewind(
+                const size_t arenaSize = 64 << 20,
+                const u16_fast keyframeInterval = 60)
+              : arenaSize{arenaSize}, keyframeInterval{keyframeInterval} {
+        }
+
+        //Frames between snapshots (0 disables rewinding):
+        u32_fast interval {1};
+
+        size_t snapshotCount() const {
+            return entries.size();
+        }
+        size_t memoryUsed() const {
+            return used;
+        }
+
+        void clear() {
+            entries.clear();
+            used = 0;
+            keyStateId = ~static_cast<u32_fast>(0);
+            framesSinceSnapshot = 0;
+        }
+
+        //Call once per emulated frame:
+        void capture(Nes& nes) {
+            if (!interval || ++framesSinceSnapshot < interval) {
+                return;
+            }
+            framesSinceSnapshot = 0;
+
+            const size_t size {nes.stateSize()};
+            if (size != stateSize) {
+                //(only when another cartridge is loaded)
+                clear();
+                stateSize = size;
+                state.resize(size);
+                keyState.resize(size);
+                delta.resize(size);
+                encoded.resize(lz::maxCompressedSize(size));
+            }
+            if (!arena) {
+                arena.reset(new u8[arenaSize]);
+            }
+            nes.saveToBuffer(state.data(), stateSize);
+            store();
+        }
+
+        //Loads the newest snapshot and drops it, so repeated calls keep
+        //going back. Returns false once there are none left (a damaged one
+        //drops the rest, since they may depend on it):
+        bool stepBack(Nes& nes) {
+            if (entries.empty()) {
+                return false;
+            }
+            const Entry newest {entries.back()};
+            const u8* const reference {
+                    newest.deltaIndex ? keyframe(newest.keyId) : nullptr};
+            if (
+                    (newest.deltaIndex && !reference)
+                 || !decode(
+                            arena.get() + newest.offset, newest.size,
+                            reference, state.data())) {
+                //(nothing older can be trusted either)
+                clear();
+                return false;
+            }
+            entries.pop_back();
+            used -= newest.size;
+            //(ids stay consecutive)
+            nextId = newest.id;
+            if (keyStateId == newest.id) {
+                keyStateId = ~static_cast<u32_fast>(0);
+            }
+            framesSinceSnapshot = 0;
+            return nes.loadFromBuffer(state.data(), stateSize);
+        }
+};
@@ -0,0 +1,66 @@
+#pragma once
+#include <vector>
+#include <chrono>
+#include "byte.hpp"
+#include "nes-system.hpp"
+
+//Hides frames of a game's own input lag: each frame is run for real,
+//unseen, then saved, and the frames that follow are run with the same
+//input to show the last of them before the real state is loaded back.
+//The frames run ahead are silent and, but for the last, not composited.
+class RunAhead {
+    private:
+        std::vector<u8> state;
+
+        static void runOne(Nes& nes) {
+            for (u32_fast frame {nes.frame}; frame == nes.frame; ) {
+                nes.tick();
+            }
+        }
+
+    public:
+        //Frames to run ahead (0 runs normally):
+        u8_fast frames {0};
+        //Time the last frame spent on top of running normally (saving,
+        //running ahead and loading), in milliseconds:
+        double cost {0};
+
+        //Runs a frame and flushes its audio:
+        void runFrame(Nes& nes) {
+            if (!frames) {
+                runOne(nes);
+                nes.flushAudio();
+                cost = 0;
+                return;
+            }
+
+            nes.skipFrame();
+            runOne(nes);
+            nes.flushAudio();
+
+            const auto startTime {std::chrono::steady_clock::now()};
+            const size_t size {nes.saveToBuffer(state.data(), state.size())};
+            if (size > state.size()) {
+                //(only when another cartridge is loaded)
+                state.resize(size);
+                nes.saveToBuffer(state.data(), size);
+            }
+            const bool audioEnabled {nes.audioEnabled};
+            nes.audioEnabled = false;
+            for (u8_fast i {1}; i <= frames; ++i) {
+                if (i < frames) {
+                    nes.skipFrame();
+                }
+                runOne(nes);
+            }
+            nes.loadFromBuffer(state.data(), size);
+            //(with audio off, this only winds the audio frame back to where
+            //the real frame ended)
+            nes.flushAudio();
+            nes.audioEnabled = audioEnabled;
+
+            const std::chrono::duration<double, std::milli> elapsed {
+                    std::chrono::steady_clock::now() - startTime};
+            cost = elapsed.count();
+        }
+};
@@ -0,0 +1,203 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include "byte.hpp"
+
+//Savestate format (little endian):
+//  header:
+//      magic    4 bytes  "NSST"
+//      version  4 bytes  bumped when the container itself changes
+//      size     4 bytes  total size, header included
+//  then chunks, one per component:
+//      tag      4 bytes  ASCII, e.g. "CPU "
+//      length   4 bytes  payload size
+//      payload  length bytes
+//Loaders skip chunks with unknown tags, and a payload shorter than its
+//loader expects reads as zeros past its end, so components only ever
+//append fields and older states keep loading.
+//Savestate files hold the state compressed (see lz.hpp):
+//      magic    4 bytes  "NSSZ"
+//      size     4 bytes  size of the state
+//      length   4 bytes  size of the compressed state
+//      payload  length bytes
+//though uncompressed states load too.
+namespace savestate {
+    constexpr u32 magic {0x5453534E};
+    constexpr u32 version {1};
+    constexpr size_t headerSize {12};
+    constexpr size_t chunkHeaderSize {8};
+    constexpr u32 compressedMagic {0x5A53534E};
+    constexpr size_t compressedHeaderSize {12};
+    //Largest size a loader accepts:
+    constexpr size_t maxSize {1 << 24};
+
+    constexpr u32 tag(const char* const name) {
+        return
+                static_cast<u32>(name[0])
+              | static_cast<u32>(name[1]) << 8
+              | static_cast<u32>(name[2]) << 16
+              | static_cast<u32>(name[3]) << 24;
+    }
+}
+
+//Serializes a state into one contiguous buffer. Writes past the end of
+//the buffer are dropped but still counted, so after a pass size() is
+//the capacity the state needs:
+class StateWriter {
+    private:
+        u8* const data;
+        const size_t capacity;
+        size_t position {0};
+        //Where the open chunk's payload starts:
+        size_t chunkStart {0};
+
+    public:
+        StateWriter(u8* const data, const size_t capacity)
+              : data{data}, capacity{capacity} {
+        }
+
+        size_t size() const {
+            return position;
+        }
+        bool fits() const {
+            return position <= capacity;
+        }
+
+        void write(const void* const source, const size_t count) {
+            if (count <= capacity && position <= capacity - count) {
+                std::memcpy(data + position, source, count);
+            }
+            position += count;
+        }
+
+        //Returns where the next count bytes go, for components that fill
+        //them directly (nullptr if they don't fit):
+        u8* reserve(const size_t count) {
+            u8* const result {
+                    count <= capacity && position <= capacity - count
+                  ? data + position
+                  : nullptr};
+            position += count;
+            return result;
+        }
+
+        void writeHeader() {
+            u8 header[savestate::headerSize];
+            writeBytes<4>(header + 0, savestate::magic);
+            writeBytes<4>(header + 4, savestate::version);
+            //(filled in by finish())
+            writeBytes<4>(header + 8, 0);
+            write(header, savestate::headerSize);
+        }
+        void finish() {
+            if (fits() && position >= savestate::headerSize) {
+                writeBytes<4>(data + 8, position);
+            }
+        }
+
+        void beginChunk(const u32 tag) {
+            u8 header[savestate::chunkHeaderSize];
+            writeBytes<4>(header + 0, tag);
+            //(filled in by endChunk())
+            writeBytes<4>(header + 4, 0);
+            write(header, savestate::chunkHeaderSize);
+            chunkStart = position;
+        }
+        void endChunk() {
+            if (fits()) {
+                writeBytes<4>(
+                        data + chunkStart - 4,
+                        position - chunkStart);
+            }
+        }
+};
+
+//Reads a state, or one chunk of it, from a buffer:
+class StateReader {
+    private:
+        const u8* data;
+        size_t remaining;
+
+    public:
+        StateReader(const u8* const data, const size_t size)
+              : data{data}, remaining{size} {
+        }
+
+        size_t size() const {
+            return remaining;
+        }
+
+        //(reads past the end give zeros)
+        void read(void* const destination, const size_t count) {
+            const size_t available {std::min(count, remaining)};
+            std::memcpy(destination, data, available);
+            std::memset(
+                    static_cast<u8*>(destination) + available,
+                    0,
+                    count - available);
+            data += available;
+            remaining -= available;
+        }
+
+        //Returns where the next count bytes are, for components that read
+        //them directly (nullptr if the chunk is too short):
+        const u8* consume(const size_t count) {
+            if (count > remaining) {
+                data += remaining;
+                remaining = 0;
+                return nullptr;
+            }
+            const u8* const result {data};
+            data += count;
+            remaining -= count;
+            return result;
+        }
+
+        //Checks the header and narrows the reader to the chunks it
+        //describes:
+        bool readHeader() {
+            if (remaining < savestate::headerSize) {
+                return false;
+            }
+            const u32 size {readBytes<4, u32>(data + 8)};
+            if (
+                    readBytes<4, u32>(data) != savestate::magic
+                 || readBytes<4, u32>(data + 4) > savestate::version
+                 || size < savestate::headerSize
+                 || size > remaining) {
+                return false;
+            }
+            remaining = size - savestate::headerSize;
+            data += savestate::headerSize;
+            return true;
+        }
+
+        //Whether every chunk header fits, checked before anything is
+        //loaded so a damaged state leaves the system untouched:
+        bool isIntact() const {
+            StateReader reader {*this};
+            u32 tag;
+            StateReader chunk {nullptr, 0};
+            while (reader.nextChunk(tag, chunk)) {
+            }
+            return reader.remaining == 0;
+        }
+
+        //Splits off the next chunk, returning false at the end or on a
+        //damaged chunk header:
+        bool nextChunk(u32& tag, StateReader& chunk) {
+            if (remaining < savestate::chunkHeaderSize) {
+                return false;
+            }
+            const u32 length {readBytes<4, u32>(data + 4)};
+            if (length > remaining - savestate::chunkHeaderSize) {
+                return false;
+            }
+            tag = readBytes<4, u32>(data);
+            chunk = StateReader {data + savestate::chunkHeaderSize, length};
+            data += savestate::chunkHeaderSize + length;
+            remaining -= savestate::chunkHeaderSize + length;
+            return true;
+        }
+};
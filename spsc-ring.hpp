@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "byte.hpp"
+
+//Lock-free ring buffer between exactly one producer thread (write) and one
+//consumer thread (read):
+template <typename DataType>
+class SpscRing {
+    private:
+        std::vector<DataType> buffer;
+        //Items ever written and read (taken modulo the capacity):
+        std::atomic<size_t> writePosition {0};
+        std::atomic<size_t> readPosition {0};
+
+    public:
+        SpscRing(const size_t capacity)
+              : buffer(capacity) {
+        }
+
+        size_t capacity() const {
+            return buffer.size();
+        }
+
+        size_t size() const {
+            return
+                    writePosition.load(std::memory_order_acquire)
+                  - readPosition.load(std::memory_order_acquire);
+        }
+
+        //Writes up to count items and returns how many fit:
+        size_t write(const DataType* const data, size_t count) {
+            const size_t write {writePosition.load(std::memory_order_relaxed)};
+            const size_t read {readPosition.load(std::memory_order_acquire)};
+            count = std::min(count, buffer.size() - (write - read));
+
+            const size_t start {write % buffer.size()};
+            const size_t span {std::min(count, buffer.size() - start)};
+            std::copy(data, data + span, buffer.begin() + start);
+            std::copy(data + span, data + count, buffer.begin());
+
+            writePosition.store(write + count, std::memory_order_release);
+            return count;
+        }
+
+        //Reads up to count items and returns how many there were:
+        size_t read(DataType* const data, size_t count) {
+            const size_t read {readPosition.load(std::memory_order_relaxed)};
+            const size_t write {writePosition.load(std::memory_order_acquire)};
+            count = std::min(count, write - read);
+
+            const size_t start {read % buffer.size()};
+            const size_t span {std::min(count, buffer.size() - start)};
+            std::copy(
+                    buffer.begin() + start,
+                    buffer.begin() + start + span,
+                    data);
+            std::copy(
+                    buffer.begin(),
+                    buffer.begin() + (count - span),
+                    data + span);
+
+            readPosition.store(read + count, std::memory_order_release);
+            return count;
+        }
+
+        //Only while neither side is running:
+        void clear() {
+            readPosition.store(writePosition.load());
+        }
+};
@@ -0,0 +1,287 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <type_traits>
+#include <functional>
+#include "byte.hpp"
+#include "counter.hpp"
+#include "savestate.hpp"
+
+//Components declare their state once, as a list of fields visited in
+//order:
+//  template <typename Fields>
+//  void stateFields(Fields& fields) {
+//      fields.section("registers");
+//      fields.value("pc", pc, 2);
+//      fields.counter("timer", timer, 2);
+//      fields.block("ram", memory.memory.data(), 0x0800);
+//  }
+//and each visitor below turns that into one operation: saving, loading,
+//hashing or diffing. Values are stored as the given number of little
+//endian bytes (sign extended back on load), so the layout doesn't depend
+//on the size of a _fast type. Anything that isn't a plain field (an
+//iterator, say) is declared through a temporary, applied afterwards if
+//fields.isLoading().
+namespace savestate {
+    template <typename Derived>
+    class Fields {
+        private:
+            Derived& derived() {
+                return static_cast<Derived&>(*this);
+            }
+
+        public:
+            template <typename ValueType>
+            void value(
+                    const char* const name,
+                    ValueType& value,
+                    const u8_fast size) {
+                u64 raw {static_cast<u64>(value)};
+                derived().integer(name, raw, size);
+                if (derived().isLoading()) {
+                    if (
+                            std::is_signed<ValueType>::value
+                         && size < 8
+                         && raw >> (size * 8 - 1) & 1) {
+                        raw |= ~static_cast<u64>(0) << size * 8;
+                    }
+                    value = static_cast<ValueType>(raw);
+                }
+            }
+
+            //Reload value, then counter:
+            template <typename CounterType>
+            void counter(
+                    const char* const name,
+                    Counter<CounterType>& counter,
+                    const u8_fast size) {
+                value(name, counter.reload, size);
+                value(name, counter.counter, size);
+            }
+    };
+
+    //Low size bytes of a value:
+    inline u64 truncate(const u64 raw, const u8_fast size) {
+        return size < 8 ? raw & ~(~static_cast<u64>(0) << size * 8) : raw;
+    }
+    inline void splitBytes(const u64 raw, u8* const bytes, const u8_fast size) {
+        for (u8_fast i {0}; i < size; ++i) {
+            bytes[i] = raw >> i * 8;
+        }
+    }
+    inline u64 joinBytes(const u8* const bytes, const u8_fast size) {
+        u64 raw {0};
+        for (u8_fast i {0}; i < size; ++i) {
+            raw |= static_cast<u64>(bytes[i]) << i * 8;
+        }
+        return raw;
+    }
+
+    template <typename StateType>
+    class FieldWriter : public Fields<FieldWriter<StateType>> {
+        private:
+            StateType& state;
+
+        public:
+            FieldWriter(StateType& state)
+                  : state{state} {
+            }
+
+            static constexpr bool isLoading() {
+                return false;
+            }
+            void section(const char* const) {
+            }
+            void integer(const char* const, u64& raw, const u8_fast size) {
+                u8 bytes[8];
+                splitBytes(raw, bytes, size);
+                state.write(bytes, size);
+            }
+            void block(const char* const, void* const data, const size_t size) {
+                state.write(data, size);
+            }
+    };
+
+    template <typename StateType>
+    class FieldReader : public Fields<FieldReader<StateType>> {
+        private:
+            StateType& state;
+
+        public:
+            FieldReader(StateType& state)
+                  : state{state} {
+            }
+
+            static constexpr bool isLoading() {
+                return true;
+            }
+            void section(const char* const) {
+            }
+            void integer(const char* const, u64& raw, const u8_fast size) {
+                u8 bytes[8];
+                state.read(bytes, size);
+                raw = joinBytes(bytes, size);
+            }
+            void block(const char* const, void* const data, const size_t size) {
+                state.read(data, size);
+            }
+    };
+
+    //Hashes exactly what would be saved, without saving it. Blocks are
+    //hashed 32 bytes at a time as 4 independent lanes, which the CPU runs
+    //in parallel (and compilers can vectorize):
+    class FieldHasher : public Fields<FieldHasher> {
+        private:
+            static constexpr u64 prime1 {0x9E3779B185EBCA87};
+            static constexpr u64 prime2 {0xC2B2AE3D27D4EB4F};
+
+            u64 hash {0xCBF29CE484222325};
+
+            static u64 round(const u64 lane, const u64 word) {
+                const u64 sum {lane + word * prime2};
+                return (sum << 31 | sum >> 33) * prime1;
+            }
+            void mix(const u64 word) {
+                hash = (hash ^ word) * 0x9E3779B97F4A7C15;
+                hash ^= hash >> 32;
+            }
+
+        public:
+            u64 result() const {
+                return hash;
+            }
+
+            static constexpr bool isLoading() {
+                return false;
+            }
+            void section(const char* const) {
+            }
+            void integer(const char* const, u64& raw, const u8_fast size) {
+                mix(truncate(raw, size));
+            }
+            void block(const char* const, void* const data, const size_t size) {
+                const u8* const bytes {static_cast<const u8*>(data)};
+                size_t i {0};
+                if (size >= 32) {
+                    u64 lanes[4] {
+                            hash + prime1 + prime2, 
+                            hash + prime2, 
+                            hash, 
+                            hash - prime1};
+                    for (; i + 32 <= size; i += 32) {
+                        u64 words[4];
+                        std::memcpy(words, bytes + i, 32);
+                        for (u8_fast lane {0}; lane < 4; ++lane) {
+                            lanes[lane] = round(lanes[lane], words[lane]);
+                        }
+                    }
+                    for (const u64 lane : lanes) {
+                        mix(lane);
+                    }
+                }
+                for (; i + 8 <= size; i += 8) {
+                    u64 word;
+                    std::memcpy(&word, bytes + i, 8);
+                    mix(word);
+                }
+                for (; i < size; ++i) {
+                    mix(bytes[i]);
+                }
+            }
+    };
+
+    //Compares each field with its counterpart in a saved state, listing
+    //the ones that differ as "<prefix>.<section>.<name>" (with the offset
+    //of the first differing byte for blocks):
+    class FieldDiffer : public Fields<FieldDiffer> {
+        private:
+            StateReader other;
+            const std::string prefix;
+            std::string currentSection;
+            std::vector<std::string>& differences;
+
+            void report(const char* const name, const std::string& suffix) {
+                const std::string field {
+                        prefix + "."
+                      + (currentSection.empty() ? "" : currentSection + ".")
+                      + name + suffix};
+                //(fields stored as several values are listed once)
+                if (differences.empty() || differences.back() != field) {
+                    differences.push_back(field);
+                }
+            }
+
+        public:
+            FieldDiffer(
+                    const StateReader& other,
+                    const std::string& prefix,
+                    std::vector<std::string>& differences)
+                  : other{other}, prefix{prefix}, differences{differences} {
+            }
+
+            static constexpr bool isLoading() {
+                return false;
+            }
+            void section(const char* const name) {
+                currentSection = name;
+            }
+            void integer(const char* const name, u64& raw, const u8_fast size) {
+                u8 bytes[8];
+                other.read(bytes, size);
+                if (joinBytes(bytes, size) != truncate(raw, size)) {
+                    report(name, "");
+                }
+            }
+            void block(
+                    const char* const name,
+                    void* const data,
+                    const size_t size) {
+                const u8* const bytes {static_cast<const u8*>(data)};
+                const u8* const otherBytes {other.consume(size)};
+                if (!otherBytes) {
+                    report(name, " (missing)");
+                    return;
+                }
+                for (size_t i {0}; i < size; ++i) {
+                    if (bytes[i] != otherBytes[i]) {
+                        report(name, "[" + std::to_string(i) + "]");
+                        return;
+                    }
+                }
+            }
+    };
+
+    //Any of the above behind std::functions, for state only known at run
+    //time (a cartridge's mapper):
+    class DynamicFields : public Fields<DynamicFields> {
+        public:
+            template <typename FieldsType>
+            DynamicFields(FieldsType& fields)
+                  : isLoading{[&] () {
+                        return fields.isLoading();
+                    }},
+                    section{[&] (const char* const name) {
+                        fields.section(name);
+                    }},
+                    integer{[&] (
+                            const char* const name,
+                            u64& raw,
+                            const u8_fast size) {
+                        fields.integer(name, raw, size);
+                    }},
+                    block{[&] (
+                            const char* const name,
+                            void* const data,
+                            const size_t size) {
+                        fields.block(name, data, size);
+                    }} {
+            }
+
+            const std::function<bool()> isLoading;
+            const std::function<void(const char*)> section;
+            const std::function<void(const char*, u64&, u8_fast)> integer;
+            const std::function<void(const char*, void*, size_t)> block;
+    };
+}
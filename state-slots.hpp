@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "byte.hpp"
+#include "nes-system.hpp"
+
+//Numbered savestates kept in memory. All slots share one arena sized up
+//front (see prepare), so saving and loading only copy state in and out:
+class StateSlots {
+    private:
+        std::vector<u8> arena;
+        //Bytes reserved for each slot:
+        size_t slotSize {0};
+        //Size of the state in each slot (0 if empty):
+        std::vector<size_t> sizes;
+
+        u8* slotData(const u16_fast slot) {
+            return arena.data() + slot * slotSize;
+        }
+
+    public:
+        StateSlots(const u16_fast count = 10)
+              : sizes(count) {
+        }
+
+        u16_fast count() const {
+            return sizes.size();
+        }
+        bool isEmpty(const u16_fast slot) const {
+            return slot >= sizes.size() || !sizes[slot];
+        }
+
+        //Sizes the arena for the loaded cartridge, emptying every slot:
+        void prepare(Nes& nes) {
+            slotSize = nes.stateSize();
+            arena.assign(slotSize * sizes.size(), 0);
+            std::fill(sizes.begin(), sizes.end(), 0);
+        }
+        //Changes the number of slots, emptying every slot:
+        void resize(Nes& nes, const u16_fast count) {
+            sizes.resize(count);
+            prepare(nes);
+        }
+
+        //Returns false if there is no such slot:
+        bool save(Nes& nes, const u16_fast slot) {
+            if (slot >= sizes.size()) {
+                return false;
+            }
+            size_t size {nes.saveToBuffer(slotData(slot), slotSize)};
+            if (size > slotSize) {
+                //(only if prepare wasn't called for this cartridge)
+                prepare(nes);
+                size = nes.saveToBuffer(slotData(slot), slotSize);
+            }
+            sizes[slot] = size;
+            return true;
+        }
+        //Returns false if the slot is empty or there is no such slot:
+        bool load(Nes& nes, const u16_fast slot) {
+            return
+                    !isEmpty(slot)
+                 && nes.loadFromBuffer(slotData(slot), sizes[slot]);
+        }
+};
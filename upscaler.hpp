@@ -0,0 +1,548 @@
+#pragma once
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define UPSCALER_SSE2
+#endif
+#include "byte.hpp"
+#include "worker-pool.hpp"
+
+//Pixel art upscaler for finished 256x240 ARGB frames. Frames are handed to
+//a pipeline thread (so the caller can go on emulating the next frame) that
+//splits them into tiles over a WorkerPool.
+class Upscaler {
+    public:
+        enum class Mode : u8_fast {
+            NONE, NEAREST, SCALE2X, SCALE3X, XBR,
+        };
+
+        static u8_fast scale(const Mode mode) {
+            return mode == Mode::NONE
+                  ? 1
+                  : mode == Mode::SCALE2X || mode == Mode::XBR
+                  ? 2
+                  : 3;
+        }
+
+    private:
+        static constexpr u16_fast width {256};
+        static constexpr u16_fast height {240};
+        static constexpr u16_fast tileWidth {64};
+        static constexpr u16_fast tileHeight {16};
+        static constexpr u16_fast tileCount {
+                (width / tileWidth) * (height / tileHeight)};
+
+        WorkerPool& workers;
+
+        //Current job:
+        const u32* input;
+        u32* output;
+        int pitch;
+        Mode mode;
+
+        //Input for xBR with 2 pixels of edge padding, and luma and chroma
+        //per pixel for its color distances:
+        static constexpr u16_fast paddedWidth {width + 4};
+        std::vector<u32> padded;
+        std::vector<u32> yuv;
+        //Offsets from E of the pixels xBR examines around each corner, and
+        //the output pixels each corner affects; one entry per 90 degree
+        //rotation:
+        enum Neighbour : u8_fast {E, I, H, F, G, C, D, B, F4, I4, H5, I5};
+        std::array<std::array<s16_fast, 12>, 4> neighbours;
+        std::array<std::array<u8_fast, 3>, 4> corners;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable finished;
+        bool enabled {true};
+        bool pending {false};
+        float cost {0};
+        std::thread thread;
+
+        u32* outputLine(const u16_fast y) const {
+            return reinterpret_cast<u32*>(
+                    reinterpret_cast<u8*>(output) + y * pitch);
+        }
+
+        static u32 blend(const u32 target, const u32 source, const u32 weight) {
+            const u32 redBlue {(
+                    (target & 0xFF00FF) * (256 - weight)
+                  + (source & 0xFF00FF) * weight) >> 8 & 0xFF00FF};
+            const u32 green {(
+                    (target & 0x00FF00) * (256 - weight)
+                  + (source & 0x00FF00) * weight) >> 8 & 0x00FF00};
+            return 0xFF000000 | redBlue | green;
+        }
+
+        #ifdef UPSCALER_SSE2
+            static __m128i select(
+                    const __m128i mask,
+                    const __m128i yes,
+                    const __m128i no) {
+                return _mm_or_si128(
+                        _mm_and_si128(mask, yes),
+                        _mm_andnot_si128(mask, no));
+            }
+            //Stores a0 b0 c0 a1 b1 c1 ... a3 b3 c3:
+            static void storeInterleaved(
+                    u32* const destination,
+                    const __m128i a,
+                    const __m128i b,
+                    const __m128i c) {
+                const __m128 ab {_mm_castsi128_ps(_mm_unpacklo_epi32(a, b))};
+                const __m128 abHigh {_mm_castsi128_ps(_mm_unpackhi_epi32(a, b))};
+                const __m128 ca {_mm_castsi128_ps(_mm_unpacklo_epi32(c, a))};
+                const __m128 caHigh {_mm_castsi128_ps(_mm_unpackhi_epi32(c, a))};
+                const __m128 bc {_mm_castsi128_ps(_mm_unpacklo_epi32(b, c))};
+                const __m128 bcHigh {_mm_castsi128_ps(_mm_unpackhi_epi32(b, c))};
+                _mm_storeu_ps(reinterpret_cast<float*>(destination),
+                        _mm_shuffle_ps(ab, ca, _MM_SHUFFLE(3, 0, 1, 0)));
+                _mm_storeu_ps(reinterpret_cast<float*>(destination + 4),
+                        _mm_shuffle_ps(bc, abHigh, _MM_SHUFFLE(1, 0, 3, 2)));
+                _mm_storeu_ps(reinterpret_cast<float*>(destination + 8),
+                        _mm_shuffle_ps(caHigh, bcHigh, _MM_SHUFFLE(3, 2, 3, 0)));
+            }
+        #endif
+
+        void nearestTile(const u16_fast x0, const u16_fast y0) {
+            for (u16_fast y {y0}; y < y0 + tileHeight; ++y) {
+                const u32* const line {input + y * width};
+                u32* const destination {outputLine(y * 3)};
+                u16_fast x {x0};
+                #ifdef UPSCALER_SSE2
+                    for (; x < x0 + tileWidth; x += 4) {
+                        const __m128i pixels {_mm_loadu_si128(
+                                reinterpret_cast<const __m128i*>(line + x))};
+                        storeInterleaved(destination + x * 3, pixels, pixels, pixels);
+                    }
+                #endif
+                for (; x < x0 + tileWidth; ++x) {
+                    destination[x * 3] = line[x];
+                    destination[x * 3 + 1] = line[x];
+                    destination[x * 3 + 2] = line[x];
+                }
+                for (u8_fast copy {1}; copy < 3; ++copy) {
+                    std::memcpy(
+                            outputLine(y * 3 + copy) + x0 * 3,
+                            destination + x0 * 3,
+                            tileWidth * 3 * sizeof(u32));
+                }
+            }
+        }
+
+        //Scale2x/Scale3x (AdvMAME): with neighbours
+        //  A B C
+        //  D E F
+        //  G H I
+        //an output pixel copies an edge neighbour where the two neighbours
+        //it lies between agree and the edge doesn't continue past E.
+        void scale2xTile(const u16_fast x0, const u16_fast y0) {
+            for (u16_fast y {y0}; y < y0 + tileHeight; ++y) {
+                const u32* const line {input + y * width};
+                const u32* const above {y > 0 ? line - width : line};
+                const u32* const below {y < height - 1 ? line + width : line};
+                u32* const top {outputLine(y * 2)};
+                u32* const bottom {outputLine(y * 2 + 1)};
+                for (u16_fast x {x0}; x < x0 + tileWidth; ) {
+                    #ifdef UPSCALER_SSE2
+                        if (x > 0 && x + 4 < width && x + 4 <= x0 + tileWidth) {
+                            const __m128i b {_mm_loadu_si128(
+                                    reinterpret_cast<const __m128i*>(above + x))};
+                            const __m128i d {_mm_loadu_si128(
+                                    reinterpret_cast<const __m128i*>(line + x - 1))};
+                            const __m128i e {_mm_loadu_si128(
+                                    reinterpret_cast<const __m128i*>(line + x))};
+                            const __m128i f {_mm_loadu_si128(
+                                    reinterpret_cast<const __m128i*>(line + x + 1))};
+                            const __m128i h {_mm_loadu_si128(
+                                    reinterpret_cast<const __m128i*>(below + x))};
+                            const __m128i corner {_mm_andnot_si128(
+                                    _mm_or_si128(
+                                            _mm_cmpeq_epi32(b, h),
+                                            _mm_cmpeq_epi32(d, f)),
+                                    _mm_set1_epi32(-1))};
+                            const __m128i e0 {select(_mm_and_si128(
+                                    corner, _mm_cmpeq_epi32(d, b)), d, e)};
+                            const __m128i e1 {select(_mm_and_si128(
+                                    corner, _mm_cmpeq_epi32(b, f)), f, e)};
+                            const __m128i e2 {select(_mm_and_si128(
+                                    corner, _mm_cmpeq_epi32(d, h)), d, e)};
+                            const __m128i e3 {select(_mm_and_si128(
+                                    corner, _mm_cmpeq_epi32(h, f)), f, e)};
+                            _mm_storeu_si128(
+                                    reinterpret_cast<__m128i*>(top + x * 2),
+                                    _mm_unpacklo_epi32(e0, e1));
+                            _mm_storeu_si128(
+                                    reinterpret_cast<__m128i*>(top + x * 2 + 4),
+                                    _mm_unpackhi_epi32(e0, e1));
+                            _mm_storeu_si128(
+                                    reinterpret_cast<__m128i*>(bottom + x * 2),
+                                    _mm_unpacklo_epi32(e2, e3));
+                            _mm_storeu_si128(
+                                    reinterpret_cast<__m128i*>(bottom + x * 2 + 4),
+                                    _mm_unpackhi_epi32(e2, e3));
+                            x += 4;
+                            continue;
+                        }
+                    #endif
+                    const u16_fast left = x > 0 ? x - 1 : x;
+                    const u16_fast right = x < width - 1 ? x + 1 : x;
+                    const u32 b {above[x]}, d {line[left]}, e {line[x]};
+                    const u32 f {line[right]}, h {below[x]};
+                    const bool corner {b != h && d != f};
+                    top[x * 2] = corner && d == b ? d : e;
+                    top[x * 2 + 1] = corner && b == f ? f : e;
+                    bottom[x * 2] = corner && d == h ? d : e;
+                    bottom[x * 2 + 1] = corner && h == f ? f : e;
+                    ++x;
+                }
+            }
+        }
+
+        void scale3xTile(const u16_fast x0, const u16_fast y0) {
+            for (u16_fast y {y0}; y < y0 + tileHeight; ++y) {
+                const u32* const line {input + y * width};
+                const u32* const above {y > 0 ? line - width : line};
+                const u32* const below {y < height - 1 ? line + width : line};
+                u32* const top {outputLine(y * 3)};
+                u32* const middle {outputLine(y * 3 + 1)};
+                u32* const bottom {outputLine(y * 3 + 2)};
+                for (u16_fast x {x0}; x < x0 + tileWidth; ) {
+                    #ifdef UPSCALER_SSE2
+                        if (x > 0 && x + 4 < width && x + 4 <= x0 + tileWidth) {
+                            const auto load = [] (const u32* const pixels) {
+                                return _mm_loadu_si128(
+                                        reinterpret_cast<const __m128i*>(pixels));
+                            };
+                            const __m128i a {load(above + x - 1)};
+                            const __m128i b {load(above + x)};
+                            const __m128i c {load(above + x + 1)};
+                            const __m128i d {load(line + x - 1)};
+                            const __m128i e {load(line + x)};
+                            const __m128i f {load(line + x + 1)};
+                            const __m128i g {load(below + x - 1)};
+                            const __m128i h {load(below + x)};
+                            const __m128i i {load(below + x + 1)};
+                            const __m128i corner {_mm_andnot_si128(
+                                    _mm_or_si128(
+                                            _mm_cmpeq_epi32(b, h),
+                                            _mm_cmpeq_epi32(d, f)),
+                                    _mm_set1_epi32(-1))};
+                            const __m128i db {_mm_and_si128(
+                                    corner, _mm_cmpeq_epi32(d, b))};
+                            const __m128i bf {_mm_and_si128(
+                                    corner, _mm_cmpeq_epi32(b, f))};
+                            const __m128i dh {_mm_and_si128(
+                                    corner, _mm_cmpeq_epi32(d, h))};
+                            const __m128i hf {_mm_and_si128(
+                                    corner, _mm_cmpeq_epi32(h, f))};
+                            //x and not (e == y):
+                            const auto unless = [&] (
+                                    const __m128i mask,
+                                    const __m128i other) {
+                                return _mm_andnot_si128(
+                                        _mm_cmpeq_epi32(e, other), mask);
+                            };
+                            storeInterleaved(top + x * 3,
+                                    select(db, d, e),
+                                    select(_mm_or_si128(
+                                            unless(db, c),
+                                            unless(bf, a)), b, e),
+                                    select(bf, f, e));
+                            storeInterleaved(middle + x * 3,
+                                    select(_mm_or_si128(
+                                            unless(db, g),
+                                            unless(dh, a)), d, e),
+                                    e,
+                                    select(_mm_or_si128(
+                                            unless(bf, i),
+                                            unless(hf, c)), f, e));
+                            storeInterleaved(bottom + x * 3,
+                                    select(dh, d, e),
+                                    select(_mm_or_si128(
+                                            unless(dh, i),
+                                            unless(hf, g)), h, e),
+                                    select(hf, f, e));
+                            x += 4;
+                            continue;
+                        }
+                    #endif
+                    const u16_fast left = x > 0 ? x - 1 : x;
+                    const u16_fast right = x < width - 1 ? x + 1 : x;
+                    const u32 a {above[left]}, b {above[x]}, c {above[right]};
+                    const u32 d {line[left]}, e {line[x]}, f {line[right]};
+                    const u32 g {below[left]}, h {below[x]}, i {below[right]};
+                    const bool corner {b != h && d != f};
+                    const bool db {corner && d == b}, bf {corner && b == f};
+                    const bool dh {corner && d == h}, hf {corner && h == f};
+                    top[x * 3] = db ? d : e;
+                    top[x * 3 + 1] = (db && e != c) || (bf && e != a) ? b : e;
+                    top[x * 3 + 2] = bf ? f : e;
+                    middle[x * 3] = (db && e != g) || (dh && e != a) ? d : e;
+                    middle[x * 3 + 1] = e;
+                    middle[x * 3 + 2] = (bf && e != i) || (hf && e != c) ? f : e;
+                    bottom[x * 3] = dh ? d : e;
+                    bottom[x * 3 + 1] = (dh && e != i) || (hf && e != g) ? h : e;
+                    bottom[x * 3 + 2] = hf ? f : e;
+                    ++x;
+                }
+            }
+        }
+
+        //Fills lines of the padded input (from -2 to height + 1):
+        void padLines(const s16_fast first, const s16_fast last) {
+            for (s16_fast y {first}; y < last; ++y) {
+                const u32* const line {input + std::min<s16_fast>(
+                        std::max<s16_fast>(y, 0), height - 1) * width};
+                for (s16_fast x {-2}; x < static_cast<s16_fast>(width) + 2; ++x) {
+                    const u32 color {line[std::min<s16_fast>(
+                            std::max<s16_fast>(x, 0), width - 1)]};
+                    const s32_fast red = color >> 16 & 0xFF;
+                    const s32_fast green = color >> 8 & 0xFF;
+                    const s32_fast blue = color & 0xFF;
+                    const s32_fast luma {(77 * red + 150 * green + 29 * blue) >> 8};
+                    const s32_fast u {(-43 * red - 85 * green + 128 * blue) >> 8};
+                    const s32_fast v {(128 * red - 107 * green - 21 * blue) >> 8};
+                    const u32_fast index = (y + 2) * paddedWidth + x + 2;
+                    padded[index] = color;
+                    yuv[index] = luma << 16 | (u + 128) << 8 | (v + 128);
+                }
+            }
+        }
+
+        static u32_fast distance(const u32 left, const u32 right) {
+            return
+                    48 * std::abs(static_cast<s32_fast>(left >> 16)
+                                - static_cast<s32_fast>(right >> 16))
+                  + 7 * std::abs(static_cast<s32_fast>(left >> 8 & 0xFF)
+                               - static_cast<s32_fast>(right >> 8 & 0xFF))
+                  + 6 * std::abs(static_cast<s32_fast>(left & 0xFF)
+                               - static_cast<s32_fast>(right & 0xFF));
+        }
+
+        //2xBR (Hyllian): each corner of E is blended towards F or H when
+        //the color distances across the 5x5 neighbourhood show an edge
+        //running past it, with the blend's shape following the edge's
+        //slope.
+        void xbrTile(const u16_fast x0, const u16_fast y0) {
+            for (u16_fast y {y0}; y < y0 + tileHeight; ++y) {
+                u32* const top {outputLine(y * 2)};
+                u32* const bottom {outputLine(y * 2 + 1)};
+                for (u16_fast x {x0}; x < x0 + tileWidth; ++x) {
+                    const u32* const colors {
+                            padded.data() + (y + 2) * paddedWidth + x + 2};
+                    const u32* const weights {
+                            yuv.data() + (y + 2) * paddedWidth + x + 2};
+
+                    std::array<u32, 4> result;
+                    result.fill(*colors);
+                    for (u8_fast rotation {0}; rotation < 4; ++rotation) {
+                        const std::array<s16_fast, 12>& n {neighbours[rotation]};
+                        const auto color = [&] (const Neighbour neighbour) {
+                            return colors[n[neighbour]];
+                        };
+                        const auto df = [&] (
+                                const Neighbour left,
+                                const Neighbour right) {
+                            return distance(weights[n[left]], weights[n[right]]);
+                        };
+                        if (color(E) == color(H) || color(E) == color(F)) {
+                            continue;
+                        }
+                        const u32_fast e {
+                                df(E, C) + df(E, G) + df(I, H5) + df(I, F4)
+                              + (df(H, F) << 2)};
+                        const u32_fast i {
+                                df(H, D) + df(H, I5) + df(F, I4) + df(F, B)
+                              + (df(E, I) << 2)};
+                        if (e > i) {
+                            continue;
+                        }
+                        const u32 pixel {df(E, F) <= df(E, H) ? color(F) : color(H)};
+                        u32& corner {result[corners[rotation][0]]};
+                        u32& up {result[corners[rotation][1]]};
+                        u32& left {result[corners[rotation][2]]};
+                        if (e < i && (
+                                (color(F) != color(B) && color(H) != color(D))
+                             || (color(E) == color(I)
+                                     && color(F) != color(I4)
+                                     && color(H) != color(I5))
+                             || color(E) == color(G)
+                             || color(E) == color(C))) {
+                            const u32_fast ke {df(F, G)};
+                            const u32_fast ki {df(H, C)};
+                            const bool leftEdge {
+                                    ke << 1 <= ki
+                                 && color(E) != color(G)
+                                 && color(D) != color(G)};
+                            const bool upEdge {
+                                    ke >= ki << 1
+                                 && color(E) != color(C)
+                                 && color(B) != color(C)};
+                            if (leftEdge && upEdge) {
+                                corner = blend(corner, pixel, 224);
+                                left = blend(left, pixel, 64);
+                                up = left;
+                            }
+                            else if (leftEdge) {
+                                corner = blend(corner, pixel, 192);
+                                left = blend(left, pixel, 64);
+                            }
+                            else if (upEdge) {
+                                corner = blend(corner, pixel, 192);
+                                up = blend(up, pixel, 64);
+                            }
+                            else {
+                                corner = blend(corner, pixel, 128);
+                            }
+                        }
+                        else {
+                            corner = blend(corner, pixel, 64);
+                        }
+                    }
+                    top[x * 2] = result[0];
+                    top[x * 2 + 1] = result[1];
+                    bottom[x * 2] = result[2];
+                    bottom[x * 2 + 1] = result[3];
+                }
+            }
+        }
+
+        void upscale() {
+            if (mode == Mode::XBR) {
+                workers.run(height + 4, [this] (u32_fast first, u32_fast last) {
+                    padLines(first - 2, last - 2);
+                });
+            }
+            workers.run(tileCount, [this] (u32_fast first, u32_fast last) {
+                for (u32_fast tile {first}; tile < last; ++tile) {
+                    const u16_fast x0 = tile % (width / tileWidth) * tileWidth;
+                    const u16_fast y0 = tile / (width / tileWidth) * tileHeight;
+                    switch (mode) {
+                    case Mode::NEAREST:
+                        nearestTile(x0, y0);
+                    break;
+                    case Mode::SCALE2X:
+                        scale2xTile(x0, y0);
+                    break;
+                    case Mode::SCALE3X:
+                        scale3xTile(x0, y0);
+                    break;
+                    case Mode::XBR:
+                        xbrTile(x0, y0);
+                    break;
+                    case Mode::NONE:
+                    break;
+                    }
+                }
+            });
+        }
+
+        void pipeline() {
+            std::unique_lock<std::mutex> lock {mutex};
+            while (true) {
+                wake.wait(lock, [&] () {
+                    return !enabled || pending;
+                });
+                if (!enabled) {
+                    return;
+                }
+
+                lock.unlock();
+                const auto start {std::chrono::steady_clock::now()};
+                upscale();
+                const std::chrono::duration<float, std::milli> elapsed {
+                        std::chrono::steady_clock::now() - start};
+                lock.lock();
+
+                cost = elapsed.count();
+                pending = false;
+                finished.notify_one();
+            }
+        }
+
+    public:
+        Upscaler(WorkerPool& workers)
+              : workers{workers},
+                padded(paddedWidth * (height + 4)),
+                yuv(paddedWidth * (height + 4)) {
+            //Positions of E, I, H, F, G, C, D, B, F4, I4, H5, I5 for the
+            //bottom right corner:
+            const std::array<std::array<s8_fast, 2>, 12> offsets {{
+                    {{0, 0}}, {{1, 1}}, {{0, 1}}, {{1, 0}},
+                    {{-1, 1}}, {{1, -1}}, {{-1, 0}}, {{0, -1}},
+                    {{2, 0}}, {{2, 1}}, {{0, 2}}, {{1, 2}}}};
+            //Output pixels for the corner itself and those above and to
+            //the left of it:
+            const std::array<std::array<s8_fast, 2>, 3> outputs {{
+                    {{1, 1}}, {{1, -1}}, {{-1, 1}}}};
+            for (u8_fast rotation {0}; rotation < 4; ++rotation) {
+                //(x, y) -> (y, -x) rotates the bottom right corner to the
+                //top right:
+                const auto rotate = [&] (std::array<s8_fast, 2> offset) {
+                    for (u8_fast turn {0}; turn < rotation; ++turn) {
+                        offset = {{offset[1], static_cast<s8_fast>(-offset[0])}};
+                    }
+                    return offset;
+                };
+                for (u8_fast neighbour {0}; neighbour < 12; ++neighbour) {
+                    const std::array<s8_fast, 2> offset {rotate(offsets[neighbour])};
+                    neighbours[rotation][neighbour] =
+                            offset[1] * paddedWidth + offset[0];
+                }
+                for (u8_fast pixel {0}; pixel < 3; ++pixel) {
+                    const std::array<s8_fast, 2> offset {rotate(outputs[pixel])};
+                    corners[rotation][pixel] =
+                            (offset[1] > 0 ? 2 : 0) + (offset[0] > 0 ? 1 : 0);
+                }
+            }
+
+            thread = std::thread([this] () {
+                pipeline();
+            });
+        }
+
+        ~Upscaler() {
+            mutex.lock();
+            enabled = false;
+            mutex.unlock();
+            wake.notify_all();
+            thread.join();
+        }
+
+        //Starts upscaling a 256x240 frame into output (pitch in bytes, as
+        //SDL_LockTexture reports it). Both must stay valid until finish():
+        void start(
+                const u32* const input,
+                u32* const output,
+                const int pitch,
+                const Mode mode) {
+            std::unique_lock<std::mutex> lock {mutex};
+            this->input = input;
+            this->output = output;
+            this->pitch = pitch;
+            this->mode = mode;
+            pending = true;
+            lock.unlock();
+            wake.notify_one();
+        }
+
+        //Waits for the current frame and returns how long it took in
+        //milliseconds:
+        float finish() {
+            std::unique_lock<std::mutex> lock {mutex};
+            finished.wait(lock, [&] () {
+                return !pending;
+            });
+            return cost;
+        }
+};
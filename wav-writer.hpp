@@ -0,0 +1,180 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <memory>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "byte.hpp"
+
+//Mono 16-bit WAV files filled from the emulation thread. Samples are
+//gathered into large blocks that a background thread writes out, so the
+//caller only pays for a copy:
+class WavWriter {
+    private:
+        //Samples per file gathered before each write:
+        static constexpr u32_fast blockSize {1 << 16};
+
+        struct Block {
+            u8_fast file;
+            std::vector<s16> samples;
+        };
+
+        const u32 sampleRate;
+        std::vector<std::unique_ptr<std::ofstream>> files;
+        std::vector<u32> sampleCounts;
+        //Blocks being gathered, by file:
+        std::vector<std::vector<s16>> pending;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool enabled {true};
+        //Blocks waiting for the thread:
+        std::vector<Block> queue;
+        //Written blocks, kept to be gathered into again:
+        std::vector<std::vector<s16>> spare;
+        std::thread thread;
+
+        void writeHeader(const u8_fast file) {
+            const u32 dataSize = sampleCounts[file] * sizeof(s16);
+            std::array<u8, 44> header;
+            u8* data {header.data()};
+            auto writeTag {[&] (const char* const tag) {
+                std::copy(tag, tag + 4, data);
+                data += 4;
+            }};
+            writeTag("RIFF");
+            writeBytes<4>(data, 36 + dataSize);       data += 4;
+            writeTag("WAVE");
+            writeTag("fmt ");
+            //                  format size
+            writeBytes<4>(data, 16);                  data += 4;
+            //                  PCM
+            writeBytes<2>(data, 1);                   data += 2;
+            //                  channels
+            writeBytes<2>(data, 1);                   data += 2;
+            writeBytes<4>(data, sampleRate);          data += 4;
+            //                  bytes per second
+            writeBytes<4>(data, sampleRate * 2);      data += 4;
+            //                  bytes per sample frame
+            writeBytes<2>(data, 2);                   data += 2;
+            //                  bits per sample
+            writeBytes<2>(data, 16);                  data += 2;
+            writeTag("data");
+            writeBytes<4>(data, dataSize);
+
+            files[file]->write(
+                    reinterpret_cast<const char*>(header.data()),
+                    header.size());
+        }
+
+        void work() {
+            std::vector<Block> blocks;
+            std::unique_lock<std::mutex> lock {mutex};
+            while (true) {
+                wake.wait(lock, [&] () {
+                    return !enabled || !queue.empty();
+                });
+                if (queue.empty()) {
+                    return;
+                }
+                blocks.swap(queue);
+
+                lock.unlock();
+                for (Block& block : blocks) {
+                    //(samples are written in host order, which WAV
+                    //expects to be little endian)
+                    files[block.file]->write(
+                            reinterpret_cast<const char*>(
+                                    block.samples.data()),
+                            block.samples.size() * sizeof(s16));
+                }
+                lock.lock();
+
+                for (Block& block : blocks) {
+                    block.samples.clear();
+                    spare.push_back(std::move(block.samples));
+                }
+                blocks.clear();
+            }
+        }
+
+        //Hands a file's gathered samples to the thread:
+        void submit(const u8_fast file) {
+            std::unique_lock<std::mutex> lock {mutex};
+            queue.push_back(Block {file, std::move(pending[file])});
+            if (spare.empty()) {
+                pending[file] = std::vector<s16>();
+                pending[file].reserve(blockSize);
+            }
+            else {
+                pending[file] = std::move(spare.back());
+                spare.pop_back();
+            }
+            lock.unlock();
+            wake.notify_one();
+        }
+
+    public:
+        WavWriter(
+                const std::vector<std::string>& filenames,
+                const u32 sampleRate)
+              : sampleRate{sampleRate},
+                sampleCounts(filenames.size()),
+                pending(filenames.size()) {
+            for (u8_fast file {0}; file < filenames.size(); ++file) {
+                files.emplace_back(new std::ofstream {
+                        filenames[file],
+                        std::ofstream::binary | std::ofstream::trunc});
+                //(rewritten with the right sizes once closed)
+                writeHeader(file);
+                pending[file].reserve(blockSize);
+            }
+
+            thread = std::thread([this] () {
+                work();
+            });
+        }
+
+        ~WavWriter() {
+            for (u8_fast file {0}; file < files.size(); ++file) {
+                if (!pending[file].empty()) {
+                    submit(file);
+                }
+            }
+            mutex.lock();
+            enabled = false;
+            mutex.unlock();
+            wake.notify_one();
+            thread.join();
+
+            for (u8_fast file {0}; file < files.size(); ++file) {
+                files[file]->seekp(0, std::ios::beg);
+                writeHeader(file);
+            }
+        }
+
+        bool isOpen() const {
+            for (const auto& file : files) {
+                if (!file->good()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void write(
+                const u8_fast file,
+                const s16* const samples,
+                const u32_fast count) {
+            std::vector<s16>& block {pending[file]};
+            block.insert(block.end(), samples, samples + count);
+            sampleCounts[file] += count;
+            if (block.size() >= blockSize) {
+                submit(file);
+            }
+        }
+};
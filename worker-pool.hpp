@@ -0,0 +1,107 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <functional>
+#include "byte.hpp"
+
+//Persistent threads that split a range of work items (scanlines, tiles)
+//between themselves and the calling thread:
+class WorkerPool {
+    private:
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable finished;
+        bool enabled {true};
+        u32_fast generation {0};
+        u8_fast busyWorkers {0};
+
+        u32_fast itemCount {0};
+        std::function<void(u32_fast first, u32_fast last)> job;
+
+        std::vector<std::thread> threads;
+
+        //First item of a slice (the calling thread always takes slice 0):
+        u32_fast slice(const u8_fast index) const {
+            return itemCount * index / (threads.size() + 1);
+        }
+
+        void work(const u8_fast index) {
+            u32_fast lastGeneration {0};
+            std::unique_lock<std::mutex> lock {mutex};
+            while (true) {
+                wake.wait(lock, [&] () {
+                    return !enabled || generation != lastGeneration;
+                });
+                if (!enabled) {
+                    return;
+                }
+                lastGeneration = generation;
+
+                lock.unlock();
+                job(slice(index + 1), slice(index + 2));
+                lock.lock();
+
+                if (--busyWorkers == 0) {
+                    finished.notify_one();
+                }
+            }
+        }
+
+    public:
+        static u8_fast defaultWorkerCount() {
+            const unsigned int cores {std::thread::hardware_concurrency()};
+            return cores > 1 ? cores - 1 : 0;
+        }
+
+        WorkerPool(const u8_fast workerCount = defaultWorkerCount()) {
+            for (u8_fast i {0}; i < workerCount; ++i) {
+                threads.emplace_back([this, i] () {
+                    work(i);
+                });
+            }
+        }
+
+        ~WorkerPool() {
+            mutex.lock();
+            enabled = false;
+            mutex.unlock();
+            wake.notify_all();
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        }
+
+        u8_fast size() const {
+            return threads.size() + 1;
+        }
+
+        //Runs function over [0, count) in one contiguous slice per thread
+        //and returns once every slice is done:
+        void run(
+                const u32_fast count,
+                const std::function<void(
+                        u32_fast first,
+                        u32_fast last)>& function) {
+            if (threads.empty()) {
+                function(0, count);
+                return;
+            }
+
+            std::unique_lock<std::mutex> lock {mutex};
+            job = function;
+            itemCount = count;
+            busyWorkers = threads.size();
+            ++generation;
+            lock.unlock();
+            wake.notify_all();
+
+            function(slice(0), slice(1));
+
+            lock.lock();
+            finished.wait(lock, [&] () {
+                return busyWorkers == 0;
+            });
+        }
+};